@@ -0,0 +1,241 @@
+#include "bench_util.hpp"
+#include "../include/server.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+double nowNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int g_failures = 0;
+static std::ostream *g_checkOutput = &std::cout;
+
+void expect(bool condition, const std::string &what) {
+    if (!condition) {
+        *g_checkOutput << "FAIL: " << what << std::endl;
+        ++g_failures;
+    }
+}
+
+void setCheckOutput(std::ostream &out) {
+    g_checkOutput = &out;
+}
+
+int checkFailures() {
+    return g_failures;
+}
+
+// つなげなければ -1
+static int tryConnectTcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+int connectTcp(int port) {
+    int fd = tryConnectTcp(port);
+    if (fd < 0) {
+        std::perror("connect tcp");
+        std::exit(1);
+    }
+    return fd;
+}
+
+int connectUnix(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        std::perror("connect unix");
+        std::exit(1);
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+void readUntil(int fd, const std::string &needle) {
+    std::string pending;
+    char buffer[4096];
+    while (pending.find(needle) == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            std::perror("recv");
+            std::exit(1);
+        }
+        pending.append(buffer, n);
+        // 探す文字列がまたがる分だけ残して、長い応答でも溜め込まない
+        if (pending.size() > 2 * needle.size() + sizeof(buffer)) {
+            pending.erase(0, pending.size() - needle.size());
+        }
+    }
+}
+
+void registerClient(int fd, const std::string &nick, const std::string &channel) {
+    sendAll(fd, "PASS pw\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :" + nick + "\r\nJOIN " + channel + "\r\n");
+    readUntil(fd, " 366 " + nick + " " + channel + " ");
+}
+
+int benchPort(int offset) {
+    return 20000 + (getpid() * 7) % 20000 + offset;
+}
+
+void printLatencyHeader(const std::string &first_column) {
+    std::cout << std::left << std::setw(12) << first_column << std::right
+              << std::setw(10) << "mean" << std::setw(10) << "p50"
+              << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::endl;
+}
+
+void printLatencyRow(const std::string &label, std::vector<double> &samples) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        sum += samples[i];
+    }
+    std::cout << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << sum / samples.size()
+              << std::setw(10) << samples[samples.size() / 2]
+              << std::setw(10) << samples[samples.size() * 99 / 100]
+              << std::setw(10) << samples[samples.size() * 999 / 1000] << std::endl;
+}
+
+void printLatencyHistogram(const std::vector<double> &samples) {
+    static const int BUCKETS = 12;  // 1us 未満から 2048us 以上まで
+    size_t counts[BUCKETS] = { 0 };
+    for (size_t i = 0; i < samples.size(); ++i) {
+        int bucket = 0;
+        for (double limit = 2.0; bucket < BUCKETS - 1 && samples[i] >= limit; limit *= 2) {
+            ++bucket;
+        }
+        ++counts[bucket];
+    }
+    for (int b = 0; b < BUCKETS; ++b) {
+        if (counts[b] == 0) {
+            continue;
+        }
+        std::ostringstream range;
+        if (b == BUCKETS - 1) {
+            range << ">= " << (1 << b);
+        } else {
+            range << (b == 0 ? 0 : (1 << b)) << " - " << (2 << b);
+        }
+        double share = 100.0 * counts[b] / samples.size();
+        std::cout << "  " << std::right << std::setw(12) << range.str() << " us "
+                  << std::fixed << std::setw(6) << std::setprecision(2) << share << "% "
+                  << std::string(static_cast<size_t>(share / 2 + 0.5), '#') << std::endl;
+    }
+}
+
+BenchServer::BenchServer() : _pid(-1) {}
+
+BenchServer::~BenchServer() {
+    stop();
+}
+
+void BenchServer::start(int port, const std::string &config, bool quiet) {
+    stop();
+    std::ostringstream path;
+    path << "/tmp/ircserv-bench-" << getpid() << "-" << port << ".conf";
+    _configPath = path.str();
+    {
+        std::ofstream file(_configPath.c_str());
+        file << config;
+    }
+    std::cout.flush();
+    _pid = fork();
+    if (_pid == 0) {
+        if (std::freopen("/dev/null", "w", stdout) == NULL ||
+            (quiet && std::freopen("/dev/null", "w", stderr) == NULL)) {
+            std::exit(1);
+        }
+        Server server(port, "pw", _configPath);
+        server.start();
+        std::exit(1);
+    }
+    // 待ち受けができても設定の残り（ほかの待ち受け）を開き終えているとは限らないので、
+    // 試しの接続に QUIT を送り、イベントループが応えるか閉じるまで待つ
+    static const int POLL_US = 2000;
+    static const int TIMEOUT_US = 10000000;
+    for (int waited = 0; ; waited += POLL_US) {
+        int status;
+        if (waitpid(_pid, &status, WNOHANG) == _pid) {
+            _pid = -1;
+            std::cerr << "bench server exited during startup" << std::endl;
+            std::exit(1);
+        }
+        if (waited >= TIMEOUT_US) {
+            std::cerr << "bench server did not start listening on port " << port << std::endl;
+            stop();
+            std::exit(1);
+        }
+        int fd = tryConnectTcp(port);
+        if (fd >= 0) {
+            char buffer[512];
+            bool answered = sendAll(fd, "QUIT\r\n") && recv(fd, buffer, sizeof(buffer), 0) >= 0;
+            close(fd);
+            if (answered) {
+                return;
+            }
+        }
+        usleep(POLL_US);
+    }
+}
+
+double BenchServer::stop() {
+    if (_pid <= 0) {
+        return 0;
+    }
+    kill(_pid, SIGTERM);
+    int status;
+    rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    wait4(_pid, &status, 0, &usage);
+    _pid = -1;
+    unlink(_configPath.c_str());
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
@@ -0,0 +1,64 @@
+#ifndef BENCH_UTIL_HPP
+#define BENCH_UTIL_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sys/types.h>
+
+/**
+ * @brief 実ソケットでサーバーを動かすベンチマークの共通部品。
+ *        接続・送受信の手順、--check の確認、遅延の集計の表示と、
+ *        一時的な設定ファイルでサーバーを子プロセスに起動する処理をまとめる。
+ */
+
+double nowNanos();
+
+// 確認が成り立たなければ "FAIL: what" を書き出して失敗を数える。書き出し先は既定で標準出力
+void expect(bool condition, const std::string &what);
+void setCheckOutput(std::ostream &out);
+int checkFailures();
+
+// ループバックへつなぐ。つなげなければ終了する
+int connectTcp(int port);
+int connectUnix(const std::string &path);
+
+// 全部送る。送れなければ false（相手が閉じた接続への送信でも落ちない）
+bool sendAll(int fd, const std::string &data);
+// needle を含むデータが届くまで読む（届いた分は捨てる）。相手が閉じたら終了する
+void readUntil(int fd, const std::string &needle);
+// PASS/NICK/USER/JOIN を送り、JOIN の NAMES の終わりまで読む
+void registerClient(int fd, const std::string &nick, const std::string &channel);
+
+// 重なりにくいポート番号（プロセスごとに変わる）。offset でベンチ内の用途を分ける
+int benchPort(int offset);
+
+// 1行ぶんの遅延の統計（平均・p50・p99・p99.9、マイクロ秒）。samples は並べ替える
+void printLatencyHeader(const std::string &first_column);
+void printLatencyRow(const std::string &label, std::vector<double> &samples);
+// 遅延の分布を2倍刻みの区間ごとの割合で表示する
+void printLatencyHistogram(const std::vector<double> &samples);
+
+/**
+ * @brief 子プロセスで動かすサーバー。パスワードは "pw"。
+ */
+class BenchServer {
+private:
+    pid_t _pid;
+    std::string _configPath;
+
+    BenchServer(const BenchServer &);
+    BenchServer &operator=(const BenchServer &);
+
+public:
+    BenchServer();
+    ~BenchServer();
+
+    // config の内容を一時ファイルに書いてサーバーを起動し、port への接続にイベントループが応えるまで待つ。
+    // ログ（標準出力）は捨てる。quiet なら標準エラーも捨てる
+    void start(int port, const std::string &config, bool quiet = false);
+    // SIGTERM で止めて後始末をする。サーバーが使った CPU 時間（秒）を返す
+    double stop();
+};
+
+#endif // BENCH_UTIL_HPP
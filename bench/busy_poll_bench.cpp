@@ -0,0 +1,104 @@
+#include "bench_util.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+
+/**
+ * @brief busy-poll モードと既定の待ち方の遅延の比較。
+ *        待ち方の設定だけを変えたサーバーを子プロセスで順に動かし、ループバック TCP で
+ *        2人だけのチャネルに PRIVMSG を1通ずつ送って、相手が受け取るまでの時間の分布を出す。
+ *        続けて送る場合と、間を空けて送る場合（サーバーが眠りに入る）の両方を測る。
+ *        サーバーが使った CPU 時間も出し、遅延と引き換えに使う CPU の量が分かるようにする。
+ *
+ *        使い方: busy_poll_bench [サーバーを固定する CPU の番号（既定は最後の CPU）]
+ */
+
+static const int WARMUP = 500;
+static const int SAMPLES = 10000;
+static const int PACED_GAP_US = 200;     // 間を空けて送るときの間隔
+static const int BUSY_POLL_US = 500;     // busy-poll モードで回り続ける時間
+
+/**
+ * @brief sender から receiver へ PRIVMSG を1通送り、受け取るまでの時間を SAMPLES 回測る。
+ *        gap_us が正なら1通ごとにその時間だけ間を空ける。
+ */
+static std::vector<double> run(int sender, int receiver, int gap_us) {
+    std::vector<double> samples;
+    samples.reserve(SAMPLES);
+    const std::string message = "PRIVMSG #bench :ping\r\n";
+    for (int i = 0; i < WARMUP + SAMPLES; ++i) {
+        if (gap_us > 0) {
+            usleep(gap_us);
+        }
+        double start = nowNanos();
+        sendAll(sender, message);
+        readUntil(receiver, " :ping\r\n");
+        if (i >= WARMUP) {
+            samples.push_back((nowNanos() - start) / 1000.0);
+        }
+    }
+    return samples;
+}
+
+static void report(const std::string &label, std::vector<double> &samples) {
+    printLatencyRow(label, samples);
+    printLatencyHistogram(samples);
+}
+
+/**
+ * @brief extra_config を足した設定でサーバーを起動し、両方の送り方で測る。
+ */
+static void measureMode(const std::string &label, const std::string &extra_config) {
+    int port = benchPort(static_cast<int>(label.size()));
+    std::ostringstream config;
+    config << "bind = 127.0.0.1:" << port << "\n"
+           << "tcp_nodelay = yes\n"
+           << extra_config;
+    BenchServer server;
+    server.start(port, config.str());
+
+    int sender = connectTcp(port);
+    int receiver = connectTcp(port);
+    registerClient(receiver, "b", "#bench");
+    registerClient(sender, "a", "#bench");
+    readUntil(receiver, "JOIN #bench\r\n");
+
+    double start = nowNanos();
+    std::vector<double> back_to_back = run(sender, receiver, 0);
+    std::vector<double> paced = run(sender, receiver, PACED_GAP_US);
+    double wall = (nowNanos() - start) / 1e9;
+
+    double cpu = server.stop();
+    close(sender);
+    close(receiver);
+
+    std::cout << "== " << label << " (server CPU " << std::fixed << std::setprecision(2) << cpu
+              << " s over " << wall << " s, " << std::setprecision(0) << 100.0 * cpu / wall << "%)" << std::endl;
+    printLatencyHeader("send (usec)");
+    report("back-to-back", back_to_back);
+    std::ostringstream paced_label;
+    paced_label << "paced " << PACED_GAP_US << "us";
+    report(paced_label.str(), paced);
+    std::cout << std::endl;
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = (argc > 1) ? std::atoi(argv[1]) : static_cast<int>(cpus > 0 ? cpus - 1 : 0);
+
+    std::cout << "PRIVMSG delivery latency over loopback TCP, " << SAMPLES << " samples per pattern ("
+              << cpus << " CPUs online)" << std::endl << std::endl;
+    measureMode("default (blocking select)", "");
+    std::ostringstream busy;
+    busy << "cpu_affinity = " << cpu << "\n"
+         << "busy_poll_us = " << BUSY_POLL_US << "\n"
+         << "so_busy_poll = 50\n";
+    std::ostringstream label;
+    label << "busy-poll " << BUSY_POLL_US << "us, pinned to CPU " << cpu;
+    measureMode(label.str(), busy.str());
+    return 0;
+}
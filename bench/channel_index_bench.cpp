@@ -0,0 +1,94 @@
+#include "../include/channel_index.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <ctime>
+
+/**
+ * @brief ChannelIndex のベンチマーク。
+ *        10万件の合成チャネルに対して、インデックス検索と全件走査の所要時間を比べる。
+ */
+
+static const size_t CHANNEL_COUNT = 100000;
+static const int ROUNDS = 200;
+
+static double nowMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// 比較用：_channels を全件なめる素朴な検索
+static size_t linearSearch(const std::map<std::string, size_t> &channels, const ChannelIndex::Query &query) {
+    size_t hits = 0;
+    for (std::map<std::string, size_t>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        if (it->second >= query.min_members && it->second <= query.max_members &&
+            (query.pattern.empty() || matchWildcard(query.pattern, it->first))) {
+            ++hits;
+        }
+    }
+    return hits;
+}
+
+static void run(const char *label, const ChannelIndex &index,
+                const std::map<std::string, size_t> &channels, const ChannelIndex::Query &query) {
+    std::vector<std::string> result;
+    double start = nowMicros();
+    for (int i = 0; i < ROUNDS; ++i) {
+        result.clear();
+        index.search(query, result);
+    }
+    double indexed = (nowMicros() - start) / ROUNDS;
+
+    size_t hits = 0;
+    start = nowMicros();
+    for (int i = 0; i < ROUNDS; ++i) {
+        hits = linearSearch(channels, query);
+    }
+    double linear = (nowMicros() - start) / ROUNDS;
+
+    std::cout << std::left << std::setw(28) << label
+              << std::right << std::setw(8) << result.size()
+              << std::setw(12) << std::fixed << std::setprecision(1) << indexed
+              << std::setw(12) << linear
+              << (hits == result.size() ? "" : "  MISMATCH") << std::endl;
+}
+
+int main() {
+    static const char *groups[] = { "#proj-", "#team-", "#ops-", "#chat-" };
+    ChannelIndex index;
+    std::map<std::string, size_t> channels;
+    std::srand(42);
+    for (size_t i = 0; i < CHANNEL_COUNT; ++i) {
+        std::ostringstream oss;
+        oss << groups[i % 4] << i << (i % 3 == 0 ? "-dev" : "");
+        // 大半は少人数、ごく一部だけ大きなチャネルにする
+        size_t members = (std::rand() % 100 == 0) ? 100 + std::rand() % 900 : 1 + std::rand() % 20;
+        index.insert(oss.str(), members);
+        channels[oss.str()] = members;
+    }
+
+    std::cout << CHANNEL_COUNT << " channels, average of " << ROUNDS << " rounds (usec)" << std::endl;
+    std::cout << std::left << std::setw(28) << "query"
+              << std::right << std::setw(8) << "hits" << std::setw(12) << "indexed"
+              << std::setw(12) << "linear" << std::endl;
+
+    ChannelIndex::Query query;
+    query.pattern = "#proj-1234*";
+    run("#proj-1234*", index, channels, query);
+    query.pattern = "#team-99*-dev";
+    run("#team-99*-dev", index, channels, query);
+    query.pattern = "#*777-dev";
+    run("#*777-dev", index, channels, query);
+    query.pattern = "*9?9";
+    run("*9?9", index, channels, query);
+    query.pattern = "#ops-4246";
+    run("#ops-4246 (exact)", index, channels, query);
+    query.pattern = "";
+    query.min_members = 500;
+    run(">499", index, channels, query);
+    query.pattern = "#chat-*";
+    run("#chat-* >499", index, channels, query);
+    return 0;
+}
@@ -0,0 +1,674 @@
+#include "bench_util.hpp"
+#include "../include/server.hpp"
+#include "../include/transport.hpp"
+#include "../include/ban_list.hpp"
+#include "../include/channel_index.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <streambuf>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <ctime>
+#include <set>
+
+/**
+ * @brief コマンド処理のベンチマークと回帰確認。
+ *        MemoryTransport でサーバーを直接駆動し、カーネルを通さずに
+ *        行の切り出し・解析・振り分け・チャネルへの配送にかかる時間をコマンドごとに測る。
+ *
+ *        --check を付けると応答内容の確認だけを行い、食い違いがあれば終了コード 1 を返す。
+ */
+
+static const int BATCH = 1000;
+static const int ROUNDS = 20;
+static const int CHUNK = 20;      // 1回の読み込みで届くコマンド数
+
+// サーバーの接続・切断ログを捨てる
+class NullBuffer : public std::streambuf {
+protected:
+    virtual int overflow(int c) { return c; }
+};
+
+/**
+ * @brief MemoryTransport とそれを使うサーバーの組。
+ */
+struct Harness {
+    MemoryTransport transport;
+    Server server;
+    std::vector<int> fds;
+
+    Harness() : server("pw", transport) {}
+
+    // 入力を積み、読み切るまで処理する
+    void feed(int fd, const std::string &data) {
+        transport.deliver(fd, data);
+        while (transport.pendingInput(fd) > 0 && transport.isOpen(fd)) {
+            server.onReadable(fd);
+        }
+    }
+
+    // 全接続の送信待ちを書き出す
+    void flush() {
+        for (size_t i = 0; i < fds.size(); ++i) {
+            while (server.hasPendingOutput(fds[i]) && transport.isOpen(fds[i])) {
+                server.onWritable(fds[i]);
+            }
+        }
+        server.finishIteration();
+    }
+
+    void clearSent() {
+        for (size_t i = 0; i < fds.size(); ++i) {
+            transport.sent(fds[i]).clear();
+        }
+    }
+
+    int connect(const std::string &nick) {
+        int fd = transport.open();
+        fds.push_back(fd);
+        server.attachConnection(fd, "127.0.0.1");
+        feed(fd, "PASS pw\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :" + nick + "\r\n");
+        flush();
+        return fd;
+    }
+};
+
+static std::ostream *g_report = &std::cout;
+
+static bool contains(const std::string &haystack, const std::string &needle) {
+    return haystack.find(needle) != std::string::npos;
+}
+
+/**
+ * @brief 応答内容の回帰確認。
+ */
+static void runChecks() {
+    Harness h;
+    int alice = h.connect("alice");
+    expect(contains(h.transport.sent(alice), " 001 alice "), "registration sends 001");
+
+    int bob = h.connect("bob");
+    int eve = h.transport.open();
+    h.fds.push_back(eve);
+    h.server.attachConnection(eve, "127.0.0.1");
+    h.feed(eve, "JOIN #x\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(eve), " 451 "), "commands before registration get 451");
+
+    // 引数のない WHO や登録前の接続のニックネームでは、その接続の情報を返さない
+    int secret = h.transport.open();
+    h.fds.push_back(secret);
+    h.server.attachConnection(secret, "127.0.0.1");
+    h.feed(secret, "PASS pw\r\nUSER secret 0 * :Secret Person\r\n");
+    int pending = h.transport.open();
+    h.fds.push_back(pending);
+    h.server.attachConnection(pending, "127.0.0.1");
+    h.feed(pending, "PASS pw\r\nNICK pending\r\n");
+    h.flush();
+    h.clearSent();
+    h.feed(alice, "WHO\r\nWHO pending\r\n");
+    h.flush();
+    expect(!contains(h.transport.sent(alice), " 352 ") && contains(h.transport.sent(alice), " 315 alice * ") &&
+           contains(h.transport.sent(alice), " 315 alice pending "), "WHO does not match unregistered connections");
+    h.clearSent();
+
+    // 登録前の接続が選んだニックネームには届かず、登録済みの人が使える。登録前の側は選び直す
+    h.feed(alice, "PRIVMSG pending :are you there\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(alice), " 401 alice pending ") && h.transport.sent(pending).empty(),
+           "PRIVMSG does not reach an unregistered connection");
+    h.clearSent();
+    int owner = h.connect("pending");
+    expect(contains(h.transport.sent(owner), " 001 pending "), "unregistered connection does not hold a nick");
+    h.feed(pending, "USER late 0 * :Late\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(pending), " 433 * pending ") && !contains(h.transport.sent(pending), " 001 "),
+           "registration with a nick taken meanwhile gets 433");
+    h.feed(pending, "NICK late\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(pending), " 001 late "), "registration completes after choosing another nick");
+    h.clearSent();
+
+    // PASS/NICK/USER/JOIN を1回の書き込みで送れば、1往復で参加まで終わる
+    int dave = h.transport.open();
+    h.fds.push_back(dave);
+    h.server.attachConnection(dave, "127.0.0.1");
+    h.feed(dave, "PASS pw\r\nNICK dave\r\nUSER dave 0 * :Dave\r\nJOIN #pipelined\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(dave), " 001 dave ") &&
+           contains(h.transport.sent(dave), " 366 dave #pipelined "), "pipelined registration and JOIN in one write");
+    h.clearSent();
+
+    h.feed(alice, "JOIN #bench\r\n");
+    h.feed(bob, "JOIN #bench\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(alice), ":alice!alice@127.0.0.1 JOIN #bench\r\n"), "JOIN echoed to joiner");
+    expect(contains(h.transport.sent(alice), ":bob!bob@127.0.0.1 JOIN #bench\r\n"), "JOIN relayed to member");
+    expect(contains(h.transport.sent(bob), " 353 bob = #bench :"), "joiner gets NAMES");
+    expect(contains(h.transport.sent(bob), " 366 bob #bench "), "joiner gets end of NAMES");
+    h.clearSent();
+
+    h.feed(alice, "PRIVMSG #bench :hello there\r\n");
+    h.flush();
+    expect(h.transport.sent(bob) == ":alice!alice@127.0.0.1 PRIVMSG #bench :hello there\r\n",
+           "channel PRIVMSG delivered once to each other member");
+    expect(h.transport.sent(alice).empty(), "channel PRIVMSG not echoed to sender");
+    h.clearSent();
+
+    h.feed(bob, "PRIVMSG alice :direct\r\nFOO bar\r\n");
+    h.flush();
+    expect(h.transport.sent(alice) == ":bob!bob@127.0.0.1 PRIVMSG alice :direct\r\n", "PRIVMSG to nick");
+    expect(contains(h.transport.sent(bob), " 421 bob FOO "), "unknown command gets 421");
+    h.clearSent();
+
+    h.feed(alice, std::string(600, 'a') + "\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(alice), " 417 alice "), "over-long line gets 417");
+    h.clearSent();
+
+    // 部分書き込みでも送信内容が欠けないこと
+    h.transport.setWriteLimit(7);
+    h.feed(bob, "NAMES #bench\r\n");
+    h.flush();
+    h.transport.setWriteLimit(0);
+    expect(contains(h.transport.sent(bob), " 366 bob #bench :End of NAMES list\r\n"), "partial writes are resumed");
+    h.clearSent();
+
+    // バンリスト
+    h.feed(alice, "MODE #bench +b *!*@127.0.*\r\nMODE #bench b\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(bob), ":alice!alice@127.0.0.1 MODE #bench +b *!*@127.0.*\r\n"), "+b relayed to channel");
+    expect(contains(h.transport.sent(alice), " 367 alice #bench *!*@127.0.* alice!alice@127.0.0.1 "), "ban list entry");
+    expect(contains(h.transport.sent(alice), " 368 alice #bench "), "end of ban list");
+    int carol = h.connect("carol");
+    h.clearSent();
+    h.feed(carol, "JOIN #bench\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(carol), " 474 carol #bench "), "banned JOIN gets 474");
+    h.feed(alice, "MODE #bench -b *!*@127.0.*\r\n");
+    h.feed(carol, "JOIN #bench\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(carol), ":carol!carol@127.0.0.1 JOIN #bench\r\n"), "-b lets the user join again");
+    h.clearSent();
+
+    // 読み遅れている接続にも、制御の行は積まれたチャネル発言より先に届く
+    std::string backlog;
+    for (int i = 0; i < 50; ++i) {
+        backlog += "PRIVMSG #bench :backlog\r\n";
+    }
+    h.feed(carol, backlog);
+    h.feed(alice, "MODE #bench +t\r\n");
+    h.flush();
+    const std::string &seen = h.transport.sent(bob);
+    expect(seen.find(" MODE #bench +t\r\n") < seen.find(" PRIVMSG #bench :backlog\r\n"),
+           "MODE overtakes queued channel chat");
+    const std::string chat_line = " PRIVMSG #bench :backlog\r\n";
+    expect(seen.rfind(chat_line) == seen.size() - chat_line.size(), "queued chat follows control");
+    h.clearSent();
+
+    // 行の途中まで送ったチャネル発言は、割り込んだ制御の行より先に送り切る
+    h.feed(carol, "PRIVMSG #bench :interrupted\r\n");
+    h.transport.setWriteLimit(7);
+    h.server.onWritable(bob);
+    h.transport.setWriteLimit(0);
+    h.feed(alice, "TOPIC #bench :news\r\n");
+    h.flush();
+    expect(h.transport.sent(bob) == ":carol!carol@127.0.0.1 PRIVMSG #bench :interrupted\r\n"
+                                   ":alice!alice@127.0.0.1 TOPIC #bench :news\r\n",
+           "partially sent chat line completes before control");
+    h.clearSent();
+
+    // あふれたチャネル発言は古い行から捨てるが、制御の行は捨てない
+    std::string flood;
+    for (int i = 0; i < 3000; ++i) {
+        std::ostringstream line;
+        line << "PRIVMSG #bench :flood " << i << "\r\n";
+        flood += line.str();
+    }
+    h.feed(carol, flood);
+    h.feed(alice, "MODE #bench -t\r\n");
+    h.flush();
+    expect(h.transport.isOpen(bob), "chat overflow does not disconnect");
+    expect(contains(h.transport.sent(bob), ":alice!alice@127.0.0.1 MODE #bench -t\r\n"), "control survives chat overflow");
+    expect(contains(h.transport.sent(bob), " :flood 2999\r\n") && !contains(h.transport.sent(bob), " :flood 0\r\n"),
+           "chat overflow drops the oldest lines");
+    h.feed(bob, "STATS z\r\n");
+    h.flush();
+    expect(!contains(h.transport.sent(bob), "chat lines dropped 0 ") && contains(h.transport.sent(bob), "chat lines dropped "),
+           "dropped chat lines reported in STATS z");
+    h.clearSent();
+
+    // LIST の人数条件。負の数や数でない条件は無視し、大きな数でもあふれない
+    h.feed(bob, "LIST >2\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(bob), " 322 bob #bench 3 :") && !contains(h.transport.sent(bob), " #pipelined "),
+           "LIST >N filters by member count");
+    h.clearSent();
+    h.feed(bob, "LIST >-5,>abc,<-1,>2x\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(bob), " 322 bob #bench ") && contains(h.transport.sent(bob), " 322 bob #pipelined "),
+           "LIST ignores negative and non-numeric bounds");
+    h.clearSent();
+    h.feed(bob, "LIST >18446744073709551615\r\n");
+    h.flush();
+    expect(!contains(h.transport.sent(bob), " 322 ") && contains(h.transport.sent(bob), " 323 "),
+           "LIST with huge bounds does not wrap around");
+    h.clearSent();
+    h.feed(bob, "LIST *lined,#*ch\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(bob), " 322 bob #bench ") && contains(h.transport.sent(bob), " 322 bob #pipelined "),
+           "LIST matches patterns that start with a wildcard");
+    h.clearSent();
+
+    h.feed(bob, "QUIT :bye\r\n");
+    h.flush();
+    expect(contains(h.transport.sent(alice), ":bob!bob@127.0.0.1 QUIT :bye\r\n"), "QUIT relayed to channel");
+    expect(!h.transport.isOpen(bob), "QUIT closes the connection");
+
+    h.transport.hangup(alice);
+    h.server.onReadable(alice);
+    expect(!h.transport.isOpen(alice), "peer hangup closes the connection");
+}
+
+/**
+ * @brief コンパイル済みのバンマスク照合が、素朴なワイルドカード照合と同じ結果を返すか確かめる。
+ */
+static void checkBanMatcher() {
+    static const char *masks[] = {
+        "*!*@10.0.*", "*!*@*.example.com", "bad*!*@*", "*!~*@*", "nick", "host.name",
+        "*!user@192.168.1.?", "*!*@*.a?b.*", "a*b*c!*@*", "*!*@*", "x!y@z", "*!*@10.*.5",
+        "*!ident@*", "Spam!*@*", "spam!b?t@*"
+    };
+    static const char *users[][3] = {
+        { "alice", "alice", "10.0.3.4" }, { "bob", "bob", "irc.example.com" },
+        { "badguy", "x", "host" }, { "n", "~ident", "h" }, { "nick", "u", "h" },
+        { "n", "u", "host.name" }, { "n", "user", "192.168.1.7" }, { "n", "user", "192.168.1.77" },
+        { "n", "u", "p.aXb.q" }, { "aXbYc", "u", "h" }, { "x", "y", "z" }, { "x", "y", "10.1.2.5" },
+        { "Alice", "ALICE", "10.0.9.9" }, { "q", "q", "example.com" }, { "n", "IDENT", "h" },
+        { "n", "identd", "h" }, { "SPAM", "bot", "h" }, { "spammer", "bit", "h" }
+    };
+    for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); ++m) {
+        BanList bans;
+        bans.add(masks[m], "setter", 0);
+        std::string normalized = BanList::normalize(masks[m]);
+        for (size_t u = 0; u < sizeof(users) / sizeof(users[0]); ++u) {
+            std::string target = std::string(users[u][0]) + "!" + users[u][1] + "@" + users[u][2];
+            for (size_t i = 0; i < target.size(); ++i) {
+                target[i] = std::tolower(static_cast<unsigned char>(target[i]));
+            }
+            bool expected = matchWildcard(normalized, target);
+            expect(bans.matches(users[u][0], users[u][1], users[u][2]) == expected,
+                   "ban mask " + normalized + " against " + target);
+        }
+    }
+    // 索引の種類が混ざっても、どれか1つに一致すれば当たる
+    BanList all;
+    for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); ++m) {
+        if (std::string(masks[m]) != "*!*@*") {
+            all.add(masks[m], "setter", 0);
+        }
+    }
+    for (size_t u = 0; u < sizeof(users) / sizeof(users[0]); ++u) {
+        std::string target = std::string(users[u][0]) + "!" + users[u][1] + "@" + users[u][2];
+        for (size_t i = 0; i < target.size(); ++i) {
+            target[i] = std::tolower(static_cast<unsigned char>(target[i]));
+        }
+        bool expected = false;
+        for (size_t m = 0; m < all.entries().size(); ++m) {
+            expected = expected || matchWildcard(all.entries()[m].mask, target);
+        }
+        expect(all.matches(users[u][0], users[u][1], users[u][2]) == expected, "ban list against " + target);
+    }
+}
+
+/**
+ * @brief fd から NAMES を問い合わせ、返ってきた名前（"@" 付きを含む）を集める。
+ *        どの RPL_NAMREPLY も長すぎないことも確かめる。
+ */
+static std::set<std::string> namesOf(Harness &h, int fd, const std::string &channel) {
+    h.feed(fd, "NAMES " + channel + "\r\n");
+    h.flush();
+    std::set<std::string> names;
+    std::istringstream sent(h.transport.sent(fd));
+    std::string line;
+    while (std::getline(sent, line)) {
+        size_t body = line.find(" = " + channel + " :");
+        if (line.find(" 353 ") == std::string::npos || body == std::string::npos) {
+            continue;
+        }
+        expect(line.size() <= 512, "NAMES line fits in a message");
+        std::istringstream tokens(line.substr(body + channel.size() + 5, line.size() - body - channel.size() - 6));
+        std::string token;
+        while (tokens >> token) {
+            expect(names.insert(token).second, "NAMES lists " + token + " once");
+        }
+    }
+    h.clearSent();
+    return names;
+}
+
+/**
+ * @brief NAMES/WHO のキャッシュを、出入り・ニックネーム変更・権限変更のあとも正しく直しているか確かめる。
+ *        行が折り返される人数にして、途中の行や最後の行の人が抜ける場合も通す。
+ */
+static void checkMemberReplies() {
+    Harness h;
+    std::vector<int> members;
+    std::set<std::string> expected;
+    for (int i = 0; i < 120; ++i) {
+        std::ostringstream nick;
+        nick << "member" << i;
+        int fd = h.connect(nick.str());
+        h.feed(fd, "JOIN #names\r\n");
+        members.push_back(fd);
+        expected.insert(i == 0 ? "@" + nick.str() : nick.str());
+    }
+    h.flush();
+    h.clearSent();
+    int op = members[0];
+    expect(namesOf(h, op, "#names") == expected, "NAMES lists every member");
+
+    h.feed(members[5], "PART #names\r\n");
+    expected.erase("member5");
+    h.feed(members[119], "PART #names\r\n");
+    expected.erase("member119");
+    h.feed(members[7], "NICK renamed7\r\n");
+    expected.erase("member7");
+    expected.insert("renamed7");
+    h.feed(op, "MODE #names +o member8\r\nMODE #names +o member60\r\nMODE #names -o member60\r\n");
+    expected.erase("member8");
+    expected.insert("@member8");
+    h.feed(op, "KICK #names member9 :bye\r\n");
+    expected.erase("member9");
+    h.flush();
+    h.clearSent();
+    expect(namesOf(h, op, "#names") == expected, "NAMES follows part, nick, op and kick");
+
+    // メンバーでない人への -o/+o は 441 で断り、NAMES/WHO に加えない
+    int outsider = h.connect("outsider");
+    h.feed(op, "MODE #names -o outsider\r\nMODE #names +o outsider\r\n");
+    h.flush();
+    const std::string &refusals = h.transport.sent(op);
+    size_t first = refusals.find(" 441 member0 outsider #names ");
+    expect(first != std::string::npos && refusals.find(" 441 member0 outsider #names ", first + 1) != std::string::npos,
+           "MODE -o/+o on a non-member gets 441");
+    h.clearSent();
+    expect(namesOf(h, op, "#names") == expected, "MODE -o on a non-member leaves NAMES alone");
+    h.feed(outsider, "QUIT :bye\r\n");
+    h.flush();
+    h.clearSent();
+
+    // 1行ぶんの人が全員抜けて行が消えても、残りの行は正しい
+    for (int i = 10; i < 60; ++i) {
+        std::ostringstream nick;
+        nick << "member" << i;
+        h.feed(members[i], "QUIT :bye\r\n");
+        expected.erase(nick.str());
+    }
+    int late = h.connect("latecomer");
+    h.feed(late, "JOIN #names\r\n");
+    expected.insert("latecomer");
+    h.flush();
+    h.clearSent();
+    expect(namesOf(h, op, "#names") == expected, "NAMES after a block of members leaves");
+
+    h.feed(op, "WHO #names\r\n");
+    h.flush();
+    const std::string &who = h.transport.sent(op);
+    size_t rows = 0;
+    for (size_t pos = who.find(" 352 "); pos != std::string::npos; pos = who.find(" 352 ", pos + 1)) {
+        ++rows;
+    }
+    expect(rows == expected.size(), "WHO has one line per member");
+    expect(contains(who, " #names member7 127.0.0.1 ircserv renamed7 H :0 member7\r\n") &&
+           contains(who, " ircserv member8 H@ :0 ") && contains(who, " ircserv member60 H :0 ") &&
+           !contains(who, " member9 "), "WHO follows nick and op changes");
+    h.clearSent();
+}
+
+/**
+ * @brief 何も送っていない接続が 10000 本あっても、既定のメモリ予算に収まり、
+ *        新しい接続や発言した接続が予算超えで切られないか確かめる。
+ */
+static void checkIdleConnections() {
+    static const int IDLE = 10000;
+    Harness h;
+    for (int i = 0; i < IDLE; ++i) {
+        std::ostringstream nick;
+        nick << "idle" << i;
+        int fd = h.transport.open();
+        h.fds.push_back(fd);
+        h.server.attachConnection(fd, "127.0.0.1");
+        h.feed(fd, "PASS pw\r\nNICK " + nick.str() + "\r\nUSER " + nick.str() + " 0 * :" + nick.str() + "\r\n");
+    }
+    h.flush();
+    int alice = h.connect("alice");
+    int bob = h.connect("bob");
+    h.feed(alice, "JOIN #x\r\n");
+    h.feed(bob, "JOIN #x\r\n");
+    h.flush();
+    h.clearSent();
+    h.feed(alice, "PRIVMSG #x :hi\r\nSTATS z\r\n");
+    h.flush();
+    expect(h.transport.isOpen(alice) && h.transport.sent(bob) == ":alice!alice@127.0.0.1 PRIVMSG #x :hi\r\n",
+           "10000 idle connections do not get an active client shed");
+    const std::string &stats = h.transport.sent(alice);
+    size_t total = stats.find("z :total ");
+    expect(total != std::string::npos &&
+           std::strtoul(stats.c_str() + total + 9, NULL, 10) < ServerLimits().memory_budget,
+           "10000 idle connections fit in the default memory budget");
+    h.clearSent();
+}
+
+/**
+ * @brief 大きなチャネルへ次々に参加する（再起動のあとに全員がつなぎ直す）ときの、1回の JOIN の処理時間。
+ *        JOIN の通知と本人への NAMES は人数に比例して増えるが、NAMES の描き直しは1人ぶんで済む。
+ *        送った量も出し、人数に比例する分が配送だけになっているか見比べられるようにする。
+ */
+static void measureJoinStorm() {
+    static const int JOINERS = 5000;
+    static const int STEP = 1000;
+    Harness h;
+    std::vector<int> fds;
+    for (int i = 0; i < JOINERS; ++i) {
+        std::ostringstream nick;
+        nick << "storm" << i;
+        fds.push_back(h.connect(nick.str()));
+    }
+    h.clearSent();
+    *g_report << std::left << std::setw(30) << "JOIN storm into one channel"
+              << std::right << std::setw(12) << "per JOIN" << std::setw(14) << "bytes out" << std::endl;
+    double process = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < JOINERS; ++i) {
+        double start = nowNanos();
+        h.feed(fds[i], "JOIN #storm\r\n");
+        process += nowNanos() - start;
+        if ((i + 1) % 50 == 0) {
+            h.flush();
+            for (size_t f = 0; f < h.fds.size(); ++f) {
+                bytes += h.transport.sent(h.fds[f]).size();
+            }
+            h.clearSent();
+        }
+        if ((i + 1) % STEP == 0) {
+            std::ostringstream label;
+            label << "  members " << (i + 1 - STEP) << " - " << (i + 1);
+            *g_report << std::left << std::setw(30) << label.str()
+                      << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(12) << process / STEP << std::setw(14) << bytes / STEP << std::endl;
+            process = 0;
+            bytes = 0;
+        }
+    }
+    expect(h.transport.isOpen(fds[JOINERS - 1]), "last storm joiner stays connected");
+}
+
+/**
+ * @brief sender から lines を BATCH 回送り、1コマンドあたりの処理時間と書き出し時間を測る。
+ *        実際のループと同じく、CHUNK 回分ずつ読み込んでは書き出す。
+ */
+static void measure(Harness &h, const char *label, int sender, const std::string &lines,
+                    size_t commands_per_line_set) {
+    std::string chunk;
+    for (int i = 0; i < CHUNK; ++i) {
+        chunk += lines;
+    }
+    double process = 0;
+    double flush = 0;
+    size_t bytes = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int sent = 0; sent < BATCH; sent += CHUNK) {
+            double start = nowNanos();
+            h.feed(sender, chunk);
+            double middle = nowNanos();
+            h.flush();
+            double end = nowNanos();
+            process += middle - start;
+            flush += end - middle;
+            for (size_t i = 0; i < h.fds.size(); ++i) {
+                bytes += h.transport.sent(h.fds[i]).size();
+            }
+            h.clearSent();
+        }
+    }
+    expect(h.transport.isOpen(sender), std::string(label) + ": sender stays connected");
+    double ops = static_cast<double>(BATCH) * ROUNDS * commands_per_line_set;
+    *g_report << std::left << std::setw(30) << label
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(12) << process / ops
+              << std::setw(12) << flush / ops
+              << std::setw(14) << bytes / ops << std::endl;
+}
+
+/**
+ * @brief 500個のマスクに対する1回の照合を、コンパイル済みの照合器と素朴な全件照合で比べる。
+ */
+static void measureBanCheck() {
+    BanList bans;
+    std::vector<std::string> masks;
+    for (int i = 0; i < 500; ++i) {
+        std::ostringstream mask;
+        if (i % 4 == 0) {
+            mask << "*!*@10." << (i / 256) << "." << (i % 256) << ".*";
+        } else if (i % 4 == 1) {
+            mask << "*!*@*.isp" << i << ".example.net";
+        } else if (i % 4 == 2) {
+            mask << "spam" << i << "!*@*";
+        } else {
+            mask << "*!bot" << i << "@*";
+        }
+        bans.add(mask.str(), "setter", 0);
+        masks.push_back(BanList::normalize(mask.str()));
+    }
+    static const int LOOKUPS = 20000;
+    size_t hits = 0;
+    double start = nowNanos();
+    for (int i = 0; i < LOOKUPS; ++i) {
+        hits += bans.matches("alice", "alice", "192.168.7.1");
+    }
+    double compiled = (nowNanos() - start) / LOOKUPS;
+    start = nowNanos();
+    for (int i = 0; i < LOOKUPS / 100; ++i) {
+        for (size_t m = 0; m < masks.size(); ++m) {
+            if (matchWildcard(masks[m], "alice!alice@192.168.7.1")) {
+                ++hits;
+                break;
+            }
+        }
+    }
+    double naive = (nowNanos() - start) / (LOOKUPS / 100);
+    expect(hits == 0, "ban check benchmark does not match");
+    *g_report << std::left << std::setw(30) << "ban check, 500 masks"
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(12) << compiled << "  (naive glob loop: " << naive << ")" << std::endl;
+}
+
+static void runBenchmarks() {
+    *g_report << "average of " << ROUNDS << " x " << BATCH << " commands (nsec per command)" << std::endl;
+    *g_report << std::left << std::setw(30) << "command"
+              << std::right << std::setw(12) << "process" << std::setw(12) << "flush"
+              << std::setw(14) << "bytes out" << std::endl;
+
+    Harness h;
+    int alice = h.connect("alice");
+    int bob = h.connect("bob");
+    h.feed(alice, "JOIN #bench\r\n");
+    h.feed(bob, "JOIN #bench\r\n");
+    h.flush();
+    h.clearSent();
+
+    measure(h, "empty line (framing)", alice, "\r\n", 1);
+    measure(h, "unknown command (421)", alice, "FOO bar baz\r\n", 1);
+    measure(h, "PRIVMSG nick", alice, "PRIVMSG bob :hello, this is a short message\r\n", 1);
+    measure(h, "TOPIC query", alice, "TOPIC #bench\r\n", 1);
+    measure(h, "MODE +t / -t", alice, "MODE #bench +t\r\nMODE #bench -t\r\n", 2);
+    measure(h, "NAMES", alice, "NAMES #bench\r\n", 1);
+    measure(h, "JOIN / PART", alice, "JOIN #other\r\nPART #other\r\n", 2);
+
+    // チャネルの人数を増やしながら配送のコストを見る
+    static const size_t sizes[] = { 2, 10, 100, 1000 };
+    size_t members = 2;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        while (members < sizes[i]) {
+            std::ostringstream nick;
+            nick << "user" << members;
+            int fd = h.connect(nick.str());
+            h.feed(fd, "JOIN #bench\r\n");
+            ++members;
+        }
+        h.flush();
+        h.clearSent();
+        std::ostringstream label;
+        label << "PRIVMSG #bench (" << members << " members)";
+        measure(h, label.str().c_str(), alice, "PRIVMSG #bench :hello, this is a short message\r\n", 1);
+    }
+    measure(h, "WHO #bench (1000 members)", alice, "WHO #bench\r\n", 1);
+
+    // 大きなバンリストを持つチャネルへの JOIN（どのマスクにも当たらない場合）
+    for (int i = 0; i < 500; ++i) {
+        std::ostringstream mask;
+        if (i % 4 == 0) {
+            mask << "*!*@10." << (i / 256) << "." << (i % 256) << ".*";
+        } else if (i % 4 == 1) {
+            mask << "*!*@*.isp" << i << ".example.net";
+        } else if (i % 4 == 2) {
+            mask << "spam" << i << "!*@*";
+        } else {
+            mask << "*!bot" << i << "@*";
+        }
+        h.feed(bob, "MODE #bench +b " + mask.str() + "\r\n");
+    }
+    h.flush();
+    h.clearSent();
+    measure(h, "JOIN / PART (500 bans)", alice, "PART #bench\r\nJOIN #bench\r\n", 2);
+    measureBanCheck();
+    measureJoinStorm();
+}
+
+int main(int argc, char **argv) {
+    bool check_only = (argc > 1 && std::strcmp(argv[1], "--check") == 0);
+
+    // 結果は元の標準出力へ出し、サーバーのログは捨てる
+    std::ostream report(std::cout.rdbuf());
+    g_report = &report;
+    setCheckOutput(report);
+    NullBuffer null_buffer;
+    std::streambuf *saved_out = std::cout.rdbuf(&null_buffer);
+    std::streambuf *saved_err = std::cerr.rdbuf(&null_buffer);
+
+    runChecks();
+    checkBanMatcher();
+    checkMemberReplies();
+    checkIdleConnections();
+    if (checkFailures() == 0 && !check_only) {
+        runBenchmarks();
+    }
+    report << (checkFailures() == 0 ? "all checks passed" : "checks FAILED") << std::endl;
+
+    std::cout.rdbuf(saved_out);
+    std::cerr.rdbuf(saved_err);
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include "bench_util.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief 接続してからチャネルに参加し終えるまでの時間のベンチマーク。
+ *        子プロセスでサーバーを動かし、接続・登録・JOIN・切断を CONNECTIONS 回くり返す。
+ *        PASS/NICK/USER/JOIN を1回の書き込みで送る場合（1往復）と、
+ *        001 を待ってから JOIN を送る場合（2往復）を比べる。
+ */
+
+static const int WARMUP = 200;
+static const int CONNECTIONS = 2000;
+
+/**
+ * @brief 接続から 366（NAMES の終わり）を受け取るまでの時間を CONNECTIONS 回測る。
+ */
+static void run(const char *label, int port, bool pipelined) {
+    std::vector<double> samples;
+    samples.reserve(CONNECTIONS);
+    double total_start = nowNanos();
+    for (int i = 0; i < WARMUP + CONNECTIONS; ++i) {
+        std::ostringstream nick;
+        nick << "c" << i;
+        const std::string registration = "PASS pw\r\nNICK " + nick.str() + "\r\nUSER u 0 * :u\r\n";
+        const std::string join = "JOIN #connect\r\n";
+        if (i == WARMUP) {
+            total_start = nowNanos();
+        }
+        double start = nowNanos();
+        int fd = connectTcp(port);
+        if (pipelined) {
+            sendAll(fd, registration + join);
+        } else {
+            sendAll(fd, registration);
+            readUntil(fd, " 001 " + nick.str() + " ");
+            sendAll(fd, join);
+        }
+        readUntil(fd, " 366 " + nick.str() + " #connect ");
+        if (i >= WARMUP) {
+            samples.push_back((nowNanos() - start) / 1000.0);
+        }
+        close(fd);
+    }
+    double seconds = (nowNanos() - total_start) / 1e9;
+    printLatencyRow(label, samples);
+    std::cout << std::setw(12) << "" << std::fixed << std::setprecision(0)
+              << CONNECTIONS / seconds << " connections/s" << std::endl;
+}
+
+int main() {
+    int port = benchPort(0);
+    std::ostringstream config;
+    config << "bind = 127.0.0.1:" << port << "\n"
+           << "tcp_nodelay = yes\n";
+    BenchServer server;
+    server.start(port, config.str());
+
+    std::cout << "connect -> joined latency, " << CONNECTIONS << " connections (usec)" << std::endl;
+    printLatencyHeader("client");
+    for (int round = 0; round < 2; ++round) {
+        run("pipelined", port, true);
+        run("stepwise", port, false);
+    }
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "bench_util.hpp"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief ループバック TCP と AF_UNIX でのメッセージ遅延のベンチマーク。
+ *        子プロセスで両方の待ち受けを持つサーバーを動かし、経路ごとに2人だけのチャネルを作って
+ *        PRIVMSG を1通ずつ送り、送信から相手が受け取るまでの時間を測る。
+ */
+
+static const int WARMUP = 500;
+static const int SAMPLES = 20000;
+
+/**
+ * @brief sender から receiver へ PRIVMSG を1通送り、受け取るまでの時間を SAMPLES 回測る。
+ */
+static void run(const char *label, const std::string &channel, int sender, int receiver) {
+    std::vector<double> samples;
+    samples.reserve(SAMPLES);
+    const std::string message = "PRIVMSG " + channel + " :ping\r\n";
+    for (int i = 0; i < WARMUP + SAMPLES; ++i) {
+        double start = nowNanos();
+        sendAll(sender, message);
+        readUntil(receiver, " :ping\r\n");
+        if (i >= WARMUP) {
+            samples.push_back((nowNanos() - start) / 1000.0);
+        }
+    }
+    printLatencyRow(label, samples);
+}
+
+int main() {
+    int port = benchPort(0);
+    std::ostringstream socket_path;
+    socket_path << "/tmp/ircserv-bench-" << getpid() << ".sock";
+    std::ostringstream config;
+    config << "bind = 127.0.0.1:" << port << "\n"
+           << "bind = unix:" << socket_path.str() << "\n"
+           << "tcp_nodelay = yes\n";
+    BenchServer server;
+    server.start(port, config.str());
+
+    int tcp_sender = connectTcp(port);
+    int tcp_receiver = connectTcp(port);
+    int unix_sender = connectUnix(socket_path.str());
+    int unix_receiver = connectUnix(socket_path.str());
+    registerClient(tcp_receiver, "tcpb", "#tcp");
+    registerClient(tcp_sender, "tcpa", "#tcp");
+    registerClient(unix_receiver, "unixb", "#unix");
+    registerClient(unix_sender, "unixa", "#unix");
+    // 受け手に届いた送り手の参加通知を読み捨てておく
+    readUntil(tcp_receiver, "JOIN #tcp\r\n");
+    readUntil(unix_receiver, "JOIN #unix\r\n");
+
+    std::cout << "PRIVMSG delivery latency, " << SAMPLES << " samples (usec)" << std::endl;
+    printLatencyHeader("transport");
+    // 交互に2回ずつ測り、順番による偏りを見分けられるようにする
+    for (int round = 0; round < 2; ++round) {
+        run("tcp", "#tcp", tcp_sender, tcp_receiver);
+        run("unix", "#unix", unix_sender, unix_receiver);
+    }
+
+    server.stop();
+    unlink(socket_path.str().c_str());
+    return 0;
+}
@@ -0,0 +1,469 @@
+#include "bench_util.hpp"
+#include "../include/websocket.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * @brief WebSocket の待ち受けの動作確認とベンチマーク。
+ *
+ * 子プロセスで TCP と WebSocket の待ち受けを持つサーバーを動かし、テスト用のクライアントで
+ * ハンドシェイク・マスク付きフレーム・分割メッセージ・ping・close の扱いを確かめる。
+ * 続けて、別の子プロセスで WebSocket -> TCP の中継プロキシを動かし、
+ * サーバーに直接つないだ場合とプロキシ経由の場合の PRIVMSG の配送遅延を比べる。
+ *
+ * --check を付けると確認だけを行い、食い違いがあれば終了コード 1 を返す。
+ */
+
+static const int WARMUP = 500;
+static const int SAMPLES = 20000;
+
+/**
+ * @brief テスト用の WebSocket クライアント（送信はマスク付き、受信はマスクなしのフレーム）。
+ */
+class WsClient {
+private:
+    int _fd;
+    std::string _buffer;
+
+    // 読めるまで待って _buffer に足す。相手が閉じたら false
+    bool fill() {
+        char chunk[4096];
+        ssize_t n = recv(_fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        _buffer.append(chunk, n);
+        return true;
+    }
+
+public:
+    std::string response;     // ハンドシェイクの HTTP 応答
+
+    explicit WsClient(int port) : _fd(connectTcp(port)) {}
+    ~WsClient() { close(_fd); }
+
+    int fd() const { return _fd; }
+
+    bool handshake(const std::string &key, const std::string &extra_headers = "") {
+        sendAll(_fd, "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n" + extra_headers + "\r\n");
+        while (_buffer.find("\r\n\r\n") == std::string::npos) {
+            if (!fill()) {
+                response = _buffer;
+                return false;
+            }
+        }
+        size_t end = _buffer.find("\r\n\r\n") + 4;
+        response = _buffer.substr(0, end);
+        _buffer.erase(0, end);
+        return response.compare(0, 12, "HTTP/1.1 101") == 0;
+    }
+
+    void sendRaw(const std::string &data) {
+        sendAll(_fd, data);
+    }
+
+    void sendFrame(int opcode, const std::string &payload, bool fin = true, bool masked = true) {
+        std::string frame;
+        frame += static_cast<char>((fin ? 0x80 : 0) | opcode);
+        unsigned char mask_bit = masked ? 0x80 : 0;
+        if (payload.size() < 126) {
+            frame += static_cast<char>(mask_bit | payload.size());
+        } else {
+            frame += static_cast<char>(mask_bit | 126);
+            frame += static_cast<char>((payload.size() >> 8) & 0xff);
+            frame += static_cast<char>(payload.size() & 0xff);
+        }
+        static const char key[4] = { 0x12, 0x34, 0x56, 0x78 };
+        if (masked) {
+            frame.append(key, 4);
+        }
+        for (size_t i = 0; i < payload.size(); ++i) {
+            frame += masked ? static_cast<char>(payload[i] ^ key[i % 4]) : payload[i];
+        }
+        sendAll(_fd, frame);
+    }
+
+    void sendText(const std::string &line) {
+        sendFrame(0x1, line);
+    }
+
+    // フレームを1つ読む。相手が閉じたら opcode に -1
+    std::string readFrame(int &opcode) {
+        while (true) {
+            if (_buffer.size() >= 2) {
+                const unsigned char *p = reinterpret_cast<const unsigned char*>(_buffer.data());
+                size_t length = p[1] & 0x7f;
+                size_t header = 2;
+                if (length == 126 && _buffer.size() >= 4) {
+                    length = (p[2] << 8) | p[3];
+                    header = 4;
+                }
+                if (length != 126 && _buffer.size() >= header + length) {
+                    opcode = p[0] & 0x0f;
+                    std::string payload = _buffer.substr(header, length);
+                    _buffer.erase(0, header + length);
+                    return payload;
+                }
+            }
+            if (!fill()) {
+                opcode = -1;
+                return std::string();
+            }
+        }
+    }
+
+    // needle を含むテキストフレームが届くまで読む
+    std::string readUntil(const std::string &needle) {
+        while (true) {
+            int opcode;
+            std::string payload = readFrame(opcode);
+            if (opcode == -1 || payload.find(needle) != std::string::npos) {
+                return payload;
+            }
+        }
+    }
+
+    void registerAs(const std::string &nick, const std::string &channel) {
+        sendText("PASS pw");
+        sendText("NICK " + nick);
+        sendText("USER " + nick + " 0 * :" + nick);
+        sendText("JOIN " + channel);
+        readUntil(" 366 " + nick + " " + channel + " ");
+    }
+};
+
+struct ProxyConnection {
+    int upstream;
+    WebSocketSession session;
+    std::string pending;   // 上流から届いた、まだ改行のない行
+};
+
+/**
+ * @brief WebSocket -> TCP の中継プロキシ（比較用）。接続ごとに上流へ TCP でつなぎ直し、
+ *        フレームを解いた本文をそのまま上流へ、上流からの行をフレームにして返す。
+ */
+static void runProxy(int listen_port, int upstream_port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(listen_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(listen_fd, 16) == -1) {
+        std::perror("proxy listen");
+        std::exit(1);
+    }
+
+    std::map<int, ProxyConnection> clients;   // WebSocket 側の fd -> 接続
+    std::map<int, int> upstreams;    // 上流側の fd -> WebSocket 側の fd
+
+    while (true) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(listen_fd, &read_fds);
+        int max_fd = listen_fd;
+        for (std::map<int, ProxyConnection>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            FD_SET(it->first, &read_fds);
+            FD_SET(it->second.upstream, &read_fds);
+            max_fd = std::max(max_fd, std::max(it->first, it->second.upstream));
+        }
+        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+            continue;
+        }
+        if (FD_ISSET(listen_fd, &read_fds)) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                int upstream = connectTcp(upstream_port);
+                clients[fd].upstream = upstream;
+                upstreams[upstream] = fd;
+            }
+        }
+        std::vector<int> closing;
+        char buffer[4096];
+        for (std::map<int, ProxyConnection>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            ProxyConnection &pair = it->second;
+            if (FD_ISSET(it->first, &read_fds)) {
+                ssize_t n = recv(it->first, buffer, sizeof(buffer), 0);
+                std::string payload;
+                bool open = n > 0 && pair.session.receive(buffer, n, payload);
+                sendAll(pair.upstream, payload);
+                sendAll(it->first, pair.session.outbound());
+                pair.session.outbound().clear();
+                if (!open) {
+                    closing.push_back(it->first);
+                    continue;
+                }
+            }
+            if (FD_ISSET(pair.upstream, &read_fds)) {
+                ssize_t n = recv(pair.upstream, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    closing.push_back(it->first);
+                    continue;
+                }
+                pair.pending.append(buffer, n);
+                pair.pending.erase(0, pair.session.frameLines(pair.pending.data(), pair.pending.size()));
+                sendAll(it->first, pair.session.outbound());
+                pair.session.outbound().clear();
+            }
+        }
+        for (size_t i = 0; i < closing.size(); ++i) {
+            upstreams.erase(clients[closing[i]].upstream);
+            close(clients[closing[i]].upstream);
+            close(closing[i]);
+            clients.erase(closing[i]);
+        }
+    }
+}
+
+static void runChecks(int tcp_port, int ws_port) {
+    expect(base64Encode(sha1("abc")) == "qZk+NkcGgWq6PiVxeFDCbJzQ2J0=", "sha1(\"abc\")");
+    expect(websocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", "RFC 6455 accept key");
+
+    // 行は1回に FRAME_BATCH バイトほどずつしかフレームにしない
+    WebSocketSession session;
+    std::string ignored;
+    const std::string upgrade = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    session.receive(upgrade.data(), upgrade.size(), ignored);
+    std::string backlog;
+    while (backlog.size() < 10 * WebSocketSession::FRAME_BATCH) {
+        backlog += ":ircserv NOTICE alice :queued line\r\n";
+    }
+    session.outbound().clear();
+    size_t consumed = session.frameLines(backlog.data(), backlog.size());
+    expect(consumed >= WebSocketSession::FRAME_BATCH && consumed < WebSocketSession::FRAME_BATCH + 64 &&
+           session.outbound().size() < WebSocketSession::FRAME_BATCH + 64, "frameLines stops after one batch");
+
+    // テキストフレームで送る行の不正な UTF-8 は U+FFFD に置き換える
+    session.outbound().clear();
+    const std::string mixed = "caf\xe9 \xe2\x82\xac \xed\xa0\x80 \xe2\x82\r\n";
+    session.frameLines(mixed.data(), mixed.size());
+    expect(session.outbound().substr(2) == "caf\xef\xbf\xbd \xe2\x82\xac \xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd \xef\xbf\xbd",
+           "invalid UTF-8 replaced with U+FFFD in text frames");
+
+    WsClient alice(ws_port);
+    expect(alice.handshake("dGhlIHNhbXBsZSBub25jZQ==", "Sec-WebSocket-Protocol: text.ircv3.net\r\n"),
+           "handshake succeeds");
+    expect(alice.response.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos,
+           "handshake returns the accept key");
+    expect(alice.response.find("Sec-WebSocket-Protocol: text.ircv3.net\r\n") != std::string::npos,
+           "text.ircv3.net subprotocol selected");
+
+    // 1フレームに複数行を入れても、行ごとに処理される
+    alice.sendText("PASS pw\r\nNICK alice\r\nUSER alice 0 * :Alice\r\n");
+    std::string welcome = alice.readUntil(" 001 ");
+    expect(welcome == ":ircserv 001 alice :Welcome to the Internet Relay Network alice!alice@127.0.0.1",
+           "001 arrives as one frame without CRLF");
+    alice.sendText("JOIN #ws");
+    alice.readUntil(" 366 alice #ws ");
+
+    WsClient bob(ws_port);
+    bob.handshake("x3JJHMbDL1EzLkh9GBhXDw==");
+    bob.registerAs("bob", "#ws");
+    int tcp = connectTcp(tcp_port);
+    sendAll(tcp, "PASS pw\r\nNICK carol\r\nUSER carol 0 * :Carol\r\nJOIN #ws\r\n");
+    alice.readUntil("carol!carol@127.0.0.1 JOIN #ws");
+    bob.readUntil("carol!carol@127.0.0.1 JOIN #ws");
+
+    // 分割されたメッセージはつなげて1行になる
+    alice.sendFrame(0x1, "PRIVMSG #ws", false);
+    alice.sendFrame(0x0, " :hello over", false);
+    alice.sendFrame(0x0, " websocket", true);
+    expect(bob.readUntil("PRIVMSG") == ":alice!alice@127.0.0.1 PRIVMSG #ws :hello over websocket",
+           "fragmented message relayed to WebSocket member");
+    std::string tcp_data;
+    char buffer[4096];
+    while (tcp_data.find("PRIVMSG #ws :hello over websocket\r\n") == std::string::npos) {
+        ssize_t n = recv(tcp, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        tcp_data.append(buffer, n);
+    }
+    expect(tcp_data.find(":alice!alice@127.0.0.1 PRIVMSG #ws :hello over websocket\r\n") != std::string::npos,
+           "WebSocket message relayed to TCP member with CRLF");
+    sendAll(tcp, "PRIVMSG #ws :from tcp\r\n");
+    expect(alice.readUntil("from tcp") == ":carol!carol@127.0.0.1 PRIVMSG #ws :from tcp",
+           "TCP message relayed to WebSocket member");
+    sendAll(tcp, "PRIVMSG #ws :caf\xe9\r\n");
+    expect(alice.readUntil("PRIVMSG #ws :caf") == ":carol!carol@127.0.0.1 PRIVMSG #ws :caf\xef\xbf\xbd",
+           "Latin-1 from TCP reaches a text WebSocket client as valid UTF-8");
+    close(tcp);
+
+    // 1文字がフレームをまたいでもよいが、不正な UTF-8 のテキストは 1007 で閉じる
+    alice.sendFrame(0x1, "PRIVMSG #ws :\xe2\x82", false);
+    alice.sendFrame(0x0, "\xac euro", true);
+    expect(bob.readUntil("euro") == ":alice!alice@127.0.0.1 PRIVMSG #ws :\xe2\x82\xac euro",
+           "UTF-8 character split across fragments accepted");
+    WsClient eve(ws_port);
+    eve.handshake("AQIDBAUGBwgJCgsMDQ4PEA==");
+    int eve_opcode;
+    eve.sendFrame(0x1, "NICK \xff");
+    std::string invalid = eve.readFrame(eve_opcode);
+    expect(eve_opcode == 0x8 && invalid == std::string("\x03\xef", 2), "invalid UTF-8 text frame closed with 1007");
+
+    // 大量の応答は何回かに分けてフレームにされるが、欠けたり順番が入れ替わったりしない
+    static const int REPLIES = 2000;
+    for (int i = 0; i < REPLIES; ++i) {
+        std::ostringstream line;
+        line << "PRIVMSG nosuch" << i << " :x";
+        alice.sendText(line.str());
+    }
+    int in_order = 0;
+    while (in_order < REPLIES) {
+        int frame_opcode;
+        std::string reply = alice.readFrame(frame_opcode);
+        if (frame_opcode == -1) {
+            break;
+        }
+        std::ostringstream needle;
+        needle << " 401 alice nosuch" << in_order << " ";
+        if (reply.find(" 401 ") == std::string::npos) {
+            continue;
+        }
+        if (reply.find(needle.str()) == std::string::npos) {
+            break;
+        }
+        ++in_order;
+    }
+    expect(in_order == REPLIES, "large reply backlog arrives complete and in order");
+
+    // ping には同じ本文の pong が返る
+    int opcode = 0;
+    bob.sendFrame(0x9, "are you there");
+    std::string pong;
+    do {
+        pong = bob.readFrame(opcode);
+    } while (opcode == 0x1);
+    expect(opcode == 0xA && pong == "are you there", "ping answered with pong");
+
+    // close には close が返り、接続が閉じる
+    bob.sendFrame(0x8, std::string("\x03\xe8", 2));
+    do {
+        bob.readFrame(opcode);
+    } while (opcode == 0x1);
+    expect(opcode == 0x8, "close answered with close");
+    bob.readFrame(opcode);
+    expect(opcode == -1, "connection closed after close handshake");
+    alice.readUntil("QUIT");
+
+    // マスクのないフレームはプロトコル違反（1002）で閉じる
+    WsClient mallory(ws_port);
+    mallory.handshake("AQIDBAUGBwgJCgsMDQ4PEA==");
+    mallory.sendFrame(0x1, "NICK mallory", true, false);
+    std::string reason = mallory.readFrame(opcode);
+    expect(opcode == 0x8 && reason == std::string("\x03\xea", 2), "unmasked frame closed with 1002");
+
+    // Upgrade でない要求は 400 で断られる
+    WsClient plain(ws_port);
+    plain.sendRaw("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    plain.readFrame(opcode);
+    expect(opcode == -1, "plain HTTP request is closed");
+    WsClient old_version(ws_port);
+    old_version.sendRaw("GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 8\r\n\r\n");
+    std::string refusal;
+    ssize_t n;
+    while ((n = recv(old_version.fd(), buffer, sizeof(buffer), 0)) > 0) {
+        refusal.append(buffer, n);
+    }
+    expect(refusal.compare(0, 12, "HTTP/1.1 426") == 0 &&
+           refusal.find("Sec-WebSocket-Version: 13\r\n") != std::string::npos, "unsupported version refused with 426");
+}
+
+/**
+ * @brief sender から receiver へ PRIVMSG を1通送り、受け取るまでの時間を SAMPLES 回測る。
+ */
+static void run(const char *label, const std::string &channel, WsClient &sender, WsClient &receiver) {
+    std::vector<double> samples;
+    samples.reserve(SAMPLES);
+    for (int i = 0; i < WARMUP + SAMPLES; ++i) {
+        double start = nowNanos();
+        sender.sendText("PRIVMSG " + channel + " :ping");
+        receiver.readUntil(" :ping");
+        if (i >= WARMUP) {
+            samples.push_back((nowNanos() - start) / 1000.0);
+        }
+    }
+    printLatencyRow(label, samples);
+}
+
+static void runBenchmarks(int ws_port, int proxy_port) {
+    WsClient direct_sender(ws_port);
+    WsClient direct_receiver(ws_port);
+    WsClient proxy_sender(proxy_port);
+    WsClient proxy_receiver(proxy_port);
+    direct_sender.handshake("AAAAAAAAAAAAAAAAAAAAAA==");
+    direct_receiver.handshake("AAAAAAAAAAAAAAAAAAAAAQ==");
+    proxy_sender.handshake("AAAAAAAAAAAAAAAAAAAAAg==");
+    proxy_receiver.handshake("AAAAAAAAAAAAAAAAAAAAAw==");
+    direct_receiver.registerAs("directb", "#direct");
+    direct_sender.registerAs("directa", "#direct");
+    proxy_receiver.registerAs("proxyb", "#proxy");
+    proxy_sender.registerAs("proxya", "#proxy");
+    direct_receiver.readUntil("JOIN #direct");
+    proxy_receiver.readUntil("JOIN #proxy");
+
+    std::cout << "PRIVMSG delivery latency between WebSocket clients, " << SAMPLES << " samples (usec)" << std::endl;
+    printLatencyHeader("path");
+    for (int round = 0; round < 2; ++round) {
+        run("direct", "#direct", direct_sender, direct_receiver);
+        run("proxy", "#proxy", proxy_sender, proxy_receiver);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool check_only = (argc > 1 && std::strcmp(argv[1], "--check") == 0);
+    int tcp_port = benchPort(0);
+    int ws_port = benchPort(1);
+    int proxy_port = benchPort(2);
+    std::ostringstream config;
+    config << "bind = 127.0.0.1:" << tcp_port << "\n"
+           << "bind = ws:127.0.0.1:" << ws_port << "\n"
+           << "tcp_nodelay = yes\n";
+    BenchServer server;
+    server.start(tcp_port, config.str(), true);
+    pid_t proxy = -1;
+    if (!check_only) {
+        proxy = fork();
+        if (proxy == 0) {
+            runProxy(proxy_port, tcp_port);
+            return 1;
+        }
+        // プロキシが待ち受けを始めるまで待つ
+        usleep(100000);
+    }
+
+    runChecks(tcp_port, ws_port);
+    if (checkFailures() == 0 && !check_only) {
+        runBenchmarks(ws_port, proxy_port);
+    }
+    std::cout << (checkFailures() == 0 ? "all checks passed" : "checks FAILED") << std::endl;
+
+    server.stop();
+    if (proxy > 0) {
+        kill(proxy, SIGTERM);
+        waitpid(proxy, NULL, 0);
+    }
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#ifndef BAN_LIST_HPP
+#define BAN_LIST_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <bitset>
+#include <ctime>
+#include <cstddef>
+
+/**
+ * @brief チャネルのバンリスト（+b）と、nick!user@host に対する照合器。
+ *
+ * マスクは登録時に nick/user/host の3部分に分け、'*' で区切った固定片の列にコンパイルしておく。
+ * ホスト部の固定の前方部分（"10.0." など）または後方部分（".example.com" など）を鍵に索引を作り、
+ * JOIN 時はホスト名の先頭・末尾から索引にある長さだけを切り出して候補を引く。
+ * 索引を引く前にブルームフィルタで「どの鍵にも当たらない」ことを確かめられれば、それだけで照合を終える。
+ * ホスト部に鍵がなければ、ワイルドカードを含まないニックネーム（"nick!*@*"）か
+ * ユーザー名（"*!ident@*"）をそのまま鍵にする。
+ * どれも鍵にならないマスク（"*!*@*" や "bad*!*@*" など）は別枠で全件照合する。
+ */
+class BanList {
+public:
+    struct Entry {
+        std::string mask;     // 正規化済みのマスク（nick!user@host、小文字）
+        std::string setter;   // 設定した人の nick!user@host
+        time_t set_at;
+    };
+
+private:
+    /**
+     * @brief '*' で区切った固定片の列。固定片の中の '?' は任意の1文字に一致する。
+     */
+    struct Glob {
+        std::vector<std::string> segments;
+        bool leading_star;
+        bool trailing_star;
+
+        Glob() : leading_star(false), trailing_star(false) {}
+        explicit Glob(const std::string &pattern);
+        bool match(const std::string &str) const;
+    };
+
+    struct CompiledMask {
+        Glob nick;
+        Glob user;
+        Glob host;
+    };
+
+    typedef std::map<std::string, std::vector<size_t> > KeyIndex;
+    static const size_t BLOOM_BITS = 4096;
+
+    std::vector<Entry> _entries;
+    std::vector<CompiledMask> _compiled;   // _entries と同じ並び
+    KeyIndex _byPrefix;                    // ホスト部の固定の前方部分 -> マスク番号
+    KeyIndex _bySuffix;                    // ホスト部の固定の後方部分 -> マスク番号
+    std::set<size_t> _prefixLengths;       // _byPrefix にある鍵の長さ
+    std::set<size_t> _suffixLengths;       // _bySuffix にある鍵の長さ
+    KeyIndex _byNick;                      // ワイルドカードのないニックネーム -> マスク番号
+    KeyIndex _byUser;                      // ワイルドカードのないユーザー名 -> マスク番号
+    std::vector<size_t> _unindexed;        // 鍵を持たないマスク
+    std::bitset<BLOOM_BITS> _bloom;        // 前方・後方の鍵のブルームフィルタ
+
+    void indexEntry(size_t position);
+    void rebuildIndex();
+    bool bloomMayContain(char kind, const char *key, size_t length) const;
+    void bloomInsert(char kind, const std::string &key);
+    bool matchKey(const KeyIndex &index, const std::string &key, const std::string &nick,
+                  const std::string &user, const std::string &host) const;
+    bool matchCandidates(const std::vector<size_t> &candidates, const std::string &nick,
+                         const std::string &user, const std::string &host) const;
+
+public:
+    // "nick", "user@host", "host.name" などの省略形を nick!user@host の形にそろえる
+    static std::string normalize(const std::string &mask);
+
+    bool add(const std::string &mask, const std::string &setter, time_t set_at);  // 重複なら false
+    bool remove(const std::string &mask);                                         // なければ false
+    bool matches(const std::string &nick, const std::string &user, const std::string &host) const;
+
+    const std::vector<Entry> &entries() const;
+    size_t size() const;
+    size_t memoryFootprint() const;
+};
+
+#endif // BAN_LIST_HPP
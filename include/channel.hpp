@@ -4,8 +4,63 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include "ban_list.hpp"
 
 class Channel {
+public:
+    /**
+     * @brief 描画済みリプライ本文（NAMES/WHO/LIST の1行ぶんずつ）のキャッシュ。
+     *        表示内容に関わる変更があった時点で無効化され、次の問い合わせで描き直される。
+     */
+    struct ReplyCache {
+        std::vector<std::string> lines;
+        bool valid;
+
+        ReplyCache() : valid(false) {}
+        void invalidate() { valid = false; }
+    };
+
+    /**
+     * @brief メンバー1人につき1つの表示（NAMES の "@nick" や WHO の1行）を、送る行にまとめて持つキャッシュ。
+     *        1行には max_line バイトまで詰める（0 なら1人1行）。メンバーの出入りや表示が変わったときは
+     *        その1人と、その人が入っている1行だけを直す。変わった人は touch() で印を付けておき、
+     *        次の問い合わせで呼び出し側が set() で描き直す。行の並びは出入りによって入れ替わる。
+     */
+    class MemberReplyCache {
+    private:
+        struct Slot {
+            size_t line;        // 入っている行
+            std::string token;  // この人の表示
+        };
+
+        std::string _header;                          // 各行の先頭
+        size_t _max_line;
+        std::vector<std::string> _lines;
+        std::vector<std::vector<int> > _line_members; // 行ごとの、入っているメンバー
+        std::map<int, Slot> _slots;
+        std::set<int> _stale;                         // 描き直しが必要なメンバー
+        size_t _bytes;                                // 行と表示の文字数の合計
+        bool _valid;
+
+        void place(int client_fd, Slot &slot);
+        void unplace(int client_fd, size_t line);
+        void redraw(size_t line);
+
+    public:
+        MemberReplyCache();
+
+        bool valid() const;
+        void reset(const std::string &header, size_t max_line);  // 空の有効なキャッシュにする
+        void invalidate();                                      // 捨てる（次の問い合わせで全部描く）
+        void touch(int client_fd);                              // 表示が変わった（または加わった）
+        void remove(int client_fd);                             // 抜けた
+        void set(int client_fd, const std::string &token);      // 1人ぶんを描き直す
+        const std::set<int> &stale() const;
+        const std::vector<std::string> &lines() const;
+        size_t memoryFootprint() const;
+    };
+
 private:
     std::string _name;                  // チャネル名
     std::string _topic;                // チャネルのトピック <-- 追加
@@ -15,6 +70,11 @@ private:
     std::set<int> _invitees;
     std::string _password;  // チャンネルのパスワード
     int _user_limit;       // ユーザー数の上限 (+l モード用)
+    BanList _bans;         // バンマスク (+b モード用)
+    MemberReplyCache _names_cache;  // RPL_NAMREPLY 本文
+    MemberReplyCache _who_cache;    // RPL_WHOREPLY 本文
+    ReplyCache _list_cache;   // RPL_LIST 本文
+    size_t _accounted_bytes;  // メモリ予算に申告済みのバイト数
 
 public:
     Channel();
@@ -30,6 +90,7 @@ public:
     void addClient(int client_fd);
     void removeClient(int client_fd);
     const std::vector<int>& getClients() const;
+    bool hasClient(int client_fd) const;
     void addOperator(int client_fd);
     void removeOperator(int client_fd);
     bool isOperator(int client_fd) const;
@@ -39,6 +100,12 @@ public:
     void addInvitee(int client_fd);
     bool isInvitee(int client_fd) const;
 
+    // バンリスト（+b）
+    bool addBan(const std::string &mask, const std::string &setter);  // 重複なら false
+    bool removeBan(const std::string &mask);                          // なければ false
+    bool isBanned(const std::string &nick, const std::string &user, const std::string &host) const;
+    const std::vector<BanList::Entry>& getBans() const;
+
     // この関数の実装が必要！
     void setPassword(const std::string &password);
     const std::string& getPassword() const;
@@ -48,6 +115,17 @@ public:
     void setUserLimit(int limit);
     int getUserLimit() const;
     bool isUserLimitReached() const;  // ユーザー数が上限に達しているかチェック
+
+    // 応答キャッシュ
+    MemberReplyCache &namesCache();
+    MemberReplyCache &whoCache();
+    ReplyCache &listCache();
+    void touchMember(int client_fd);  // メンバーのニックネーム等が変わったときに呼ぶ
+
+    // メモリ使用量の概算と、予算に申告済みの値
+    size_t memoryFootprint() const;
+    size_t getAccountedBytes() const;
+    void setAccountedBytes(size_t bytes);
 };
 
 #endif // CHANNEL_HPP
\ No newline at end of file
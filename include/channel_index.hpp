@@ -0,0 +1,52 @@
+#ifndef CHANNEL_INDEX_HPP
+#define CHANNEL_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <cstddef>
+
+/**
+ * @brief ワイルドカード（* と ?）を含むパターンが文字列全体に一致するか判定する。
+ */
+bool matchWildcard(const std::string &pattern, const std::string &str);
+
+/**
+ * @brief LIST 検索用のチャネル名インデックス。
+ *
+ * 名前順の表・名前を逆順にした集合・メンバー数順の集合を持ち、前方一致（ワイルドカードの手前までの固定部分）、
+ * 後方一致（最後のワイルドカードより後ろの固定部分）、メンバー数の範囲で候補を絞り込んでから照合するため、
+ * 条件があれば全チャネルをなめずに済む（"*foo" のように先頭がワイルドカードでもよい）。
+ * チャネルの作成・破棄・メンバー数の変化に合わせてサーバーが更新する。
+ */
+class ChannelIndex {
+private:
+    typedef std::pair<size_t, std::string> SizeKey;
+
+    std::map<std::string, size_t> _sizes;      // 名前 -> メンバー数（名前順なので前方一致の範囲検索にも使う）
+    std::set<std::string> _reversed;           // 逆順にした名前（後方一致の範囲検索に使う）
+    std::set<SizeKey> _bySize;                 // (メンバー数, 名前) 順
+
+public:
+    /**
+     * @brief 検索条件。パターンが空なら名前では絞り込まない。
+     */
+    struct Query {
+        std::string pattern;
+        size_t min_members;   // この人数以上
+        size_t max_members;   // この人数以下
+
+        Query();
+    };
+
+    void insert(const std::string &name, size_t members);
+    void erase(const std::string &name);
+    void update(const std::string &name, size_t members);
+    size_t size() const;
+
+    // 条件に合うチャネル名を result に追加する（名前順とは限らない）
+    void search(const Query &query, std::vector<std::string> &result) const;
+};
+
+#endif // CHANNEL_INDEX_HPP
@@ -0,0 +1,105 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief 接続ごと・サーバー全体の資源の上限。
+ */
+struct ServerLimits {
+    size_t max_line_length;    // 1行の最大長（CRLFを含む）。受信途中のバッファもこれを超えない
+    size_t max_output_queue;   // 1接続あたりの送信待ちの上限。超えた接続は切断する
+    size_t max_chat_queue;     // 1接続あたりのチャネル発言の送信待ちの上限。超えた分は古い行から捨てる（0は無制限）
+    size_t memory_budget;      // サーバー全体のメモリ予算（0は無制限）
+    size_t max_connections;    // 同時接続数の上限（0は無制限）
+    size_t recv_buffer_size;   // 1回のrecvで読み込む最大バイト数
+
+    ServerLimits()
+        : max_line_length(512), max_output_queue(1024 * 1024), max_chat_queue(64 * 1024),
+          memory_budget(64 * 1024 * 1024),
+          max_connections(0), recv_buffer_size(1024) {}
+};
+
+/**
+ * @brief 待ち受けるアドレスとポート。path があれば AF_UNIX のソケットファイルで待ち受ける。
+ *        host に ':' を含めば IPv6、そうでなければ IPv4 として扱う。
+ *        websocket なら受け付けた接続で WebSocket のハンドシェイクとフレームの読み書きを行う。
+ */
+struct ListenAddress {
+    std::string host;
+    int port;
+    std::string path;
+    bool websocket;
+
+    ListenAddress() : port(0), websocket(false) {}
+    ListenAddress(const std::string &h, int p) : host(h), port(p), websocket(false) {}
+    bool operator==(const ListenAddress &other) const {
+        return host == other.host && port == other.port && path == other.path && websocket == other.websocket;
+    }
+    bool isUnix() const { return !path.empty(); }
+    std::string describe() const;   // ログ用の表記（"127.0.0.1:6667", "[::1]:6667", "unix:/path", "ws:..."）
+};
+
+/**
+ * @brief ソケットに設定するオプション。0 や false はカーネルの既定値のまま触らないことを表す。
+ */
+struct SocketOptions {
+    int backlog;               // listen() の待ち行列の長さ
+    int send_buffer;           // SO_SNDBUF
+    int recv_buffer;           // SO_RCVBUF
+    bool tcp_nodelay;          // TCP_NODELAY（Nagle を無効にして小さな応答をすぐ送る）
+    int defer_accept;          // TCP_DEFER_ACCEPT の秒数（Linux のみ）
+    bool keepalive;            // SO_KEEPALIVE
+    int keepalive_idle;        // TCP_KEEPIDLE の秒数
+    int keepalive_interval;    // TCP_KEEPINTVL の秒数
+    int keepalive_count;       // TCP_KEEPCNT の回数
+    int busy_poll;             // SO_BUSY_POLL のマイクロ秒（Linux のみ。受信時にドライバを直接ポーリングする）
+
+    SocketOptions()
+        : backlog(10), send_buffer(0), recv_buffer(0), tcp_nodelay(false), defer_accept(0),
+          keepalive(false), keepalive_idle(0), keepalive_interval(0), keepalive_count(0), busy_poll(0) {}
+};
+
+/**
+ * @brief イベントループの待ち方。既定ではどちらも無効で、select で眠って待つ。
+ */
+struct PollOptions {
+    int cpu;                    // イベントループを固定する CPU の番号（-1 は固定しない。Linux のみ）
+    size_t busy_poll_us;        // 待ち始めからこの時間はタイムアウト0の select で回り続ける（0 は回らない）
+
+    PollOptions() : cpu(-1), busy_poll_us(0) {}
+};
+
+/**
+ * @brief フライトレコーダーの設定。
+ */
+struct RecorderOptions {
+    size_t iterations;          // 直近何回分のループを残すか（0 は記録しない）
+    size_t slow_iteration_ms;   // 処理がこれより長くかかった回で記録を書き出す（0 は書き出さない）
+    std::string dump_dir;       // 書き出し先のディレクトリ
+
+    RecorderOptions() : iterations(256), slow_iteration_ms(100), dump_dir("/tmp") {}
+};
+
+/**
+ * @brief 設定ファイルの内容。起動時に読み込み、SIGHUP で読み直す。
+ *
+ * 書式は1行に「キー = 値」。# 以降はコメント。bind は複数書ける
+ *（"0.0.0.0", "127.0.0.1:6668", "[::]:6667", "::1", "unix:/tmp/ircserv.sock" など）。
+ * 先頭に "ws:" を付けた bind は WebSocket の待ち受けになる（"ws:0.0.0.0:8080" など）。
+ * 値の大きさには k/m/g の接尾辞（1024 倍単位）を付けられる。
+ */
+struct ServerConfig {
+    std::vector<ListenAddress> binds;   // 空なら 0.0.0.0:<起動時のポート>
+    SocketOptions socket;
+    ServerLimits limits;
+    RecorderOptions recorder;
+    PollOptions poll;
+};
+
+// path を読み込んで config を作る。bind のポート省略時は default_port を使う。失敗時は error に理由を入れる
+bool loadConfig(const std::string &path, int default_port, ServerConfig &config, std::string &error);
+
+#endif // CONFIG_HPP
@@ -0,0 +1,92 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+/**
+ * @brief フライトレコーダーに残す出来事の種類。
+ */
+enum FlightEventType {
+    FLIGHT_ACCEPT,    // 新規接続の受け付け
+    FLIGHT_READ,      // 1回の読み取りとその中で処理したコマンド全体
+    FLIGHT_COMMAND,   // 1行分のコマンド処理
+    FLIGHT_WRITE,     // 送信待ちの書き出し
+    FLIGHT_CLOSE      // 接続の後始末
+};
+
+/**
+ * @brief イベントループの直近の様子を常時記録しておくリングバッファ。
+ *
+ * ループ1回ごとの記録（select で待った時間・処理に使った時間・読み書きしたバイト数）と、
+ * その間に起きた出来事（どの fd で何のコマンドを何ナノ秒かけて処理したか）を、
+ * あらかじめ確保した固定長の配列に上書きしながら残す。記録のたびにメモリは確保しない。
+ * 取り出すときは文字列の一覧か、Chrome のトレース形式（chrome://tracing や Perfetto で開ける JSON）にする。
+ */
+class FlightRecorder {
+public:
+    struct Event {
+        unsigned long long seq;
+        long long start_ns;
+        long long duration_ns;
+        size_t bytes;
+        int fd;
+        FlightEventType type;
+        char label[16];          // コマンド名（英数字以外は '?' に置き換える）
+    };
+
+    struct Iteration {
+        unsigned long long seq;
+        unsigned long long first_event;   // この回の最初の出来事の通し番号
+        long long start_ns;               // select に入った時刻
+        long long woke_ns;                // select から戻った時刻
+        long long end_ns;                 // 後始末まで終えた時刻
+        int ready;                        // select が返した fd の数
+        size_t bytes_in;
+        size_t bytes_out;
+    };
+
+private:
+    std::vector<Iteration> _iterations;
+    std::vector<Event> _events;
+    unsigned long long _iterationSeq;    // 次に始めるループの通し番号
+    unsigned long long _eventSeq;        // 次に記録する出来事の通し番号
+    long long _origin_ns;                // トレースの時刻の基準
+    long long _slow_ns;                  // これより長く処理にかかった回を「遅い」とみなす（0 は判定しない）
+    size_t _bytesIn;                     // 起動からの累計
+    size_t _bytesOut;
+
+    Iteration &current();
+    const Iteration *find(unsigned long long seq) const;
+    const Event *findEvent(unsigned long long seq) const;
+    unsigned long long eventEnd(const Iteration &iteration) const;
+
+public:
+    static const size_t EVENTS_PER_ITERATION = 32;   // 出来事のリングはループ記録の何倍持つか
+
+    FlightRecorder();
+
+    static long long now();
+    static const char *typeName(FlightEventType type);
+
+    void configure(size_t iterations, size_t slow_iteration_ms);  // 0 回なら記録しない
+    bool enabled() const;
+
+    void beginIteration();
+    void markWoken(int ready);
+    bool endIteration();                 // 遅い回だったら true
+
+    void countBytesIn(size_t bytes);
+    void countBytesOut(size_t bytes);
+    size_t bytesIn() const;
+    size_t bytesOut() const;
+    void record(FlightEventType type, int fd, long long start_ns, size_t bytes,
+                const std::string &label = std::string());
+
+    void dumpText(std::ostream &out) const;
+    void exportTrace(std::ostream &out) const;
+};
+
+#endif // FLIGHT_RECORDER_HPP
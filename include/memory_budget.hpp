@@ -0,0 +1,46 @@
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+#include <cstddef>
+
+/**
+ * @brief メモリ使用量を集計する区分。
+ */
+enum MemoryCategory {
+    MEM_CONNECTIONS,     // 接続ごとの管理情報
+    MEM_INPUT_BUFFERS,   // 受信途中の行バッファ
+    MEM_OUTPUT_QUEUES,   // 送信待ちの出力領域
+    MEM_CHANNELS,        // チャネル本体と応答キャッシュ
+    MEM_CATEGORY_COUNT
+};
+
+/**
+ * @brief サーバー全体のメモリ予算と区分ごとの使用量。
+ *
+ * 使用量は各サブシステムが確保・解放のたびに申告する概算値（バイト）。
+ * 上限を超えたかどうかはサーバーが見て、新規接続の拒否や大きな送信待ちの切断を行う。
+ */
+class MemoryBudget {
+private:
+    size_t _usage[MEM_CATEGORY_COUNT];
+    size_t _peak[MEM_CATEGORY_COUNT];
+    size_t _limit;                      // 0 は無制限
+
+public:
+    explicit MemoryBudget(size_t limit = 0);
+
+    void charge(MemoryCategory category, size_t bytes);
+    void release(MemoryCategory category, size_t bytes);
+    void adjust(MemoryCategory category, size_t old_bytes, size_t new_bytes);
+
+    size_t usage(MemoryCategory category) const;
+    size_t peak(MemoryCategory category) const;
+    size_t total() const;
+    size_t limit() const;
+    void setLimit(size_t limit);
+    bool overBudget() const;
+
+    static const char *categoryName(MemoryCategory category);
+};
+
+#endif // MEMORY_BUDGET_HPP
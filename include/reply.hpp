@@ -0,0 +1,139 @@
+#ifndef REPLY_HPP
+#define REPLY_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "memory_budget.hpp"
+
+#define SERVER_NAME "ircserv"
+
+/**
+ * @brief 接続ごとの送信待ちデータを保持する出力領域。
+ *
+ * 初めての追記で小さな容量を確保し、足りなければ倍々に広げる。送信済みの部分は先頭位置を進めるだけで捨てる。
+ * 容量が足りている限り、追記でヒープ確保は発生しない。送り切って空になったら、小さな容量を超える分は返す
+ * （何も送っていない接続は領域を持たないので、待機中の接続が多くてもメモリ予算を食わない）。
+ * メモリ予算に結び付けると、確保している容量をその区分の使用量として申告する。
+ */
+class OutputBuffer {
+private:
+    std::vector<char> _data;  // 確保済みの領域（size()が容量）
+    size_t _head;             // 未送信データの先頭
+    size_t _tail;             // 未送信データの末尾
+    MemoryBudget *_budget;    // 容量を申告する先（NULLなら申告しない）
+    MemoryCategory _category;
+
+    void makeRoom(size_t len);
+
+public:
+    OutputBuffer();
+    explicit OutputBuffer(size_t capacity);
+    OutputBuffer(const OutputBuffer &other);             // 複製は予算に結び付けない
+    OutputBuffer &operator=(const OutputBuffer &other);
+    ~OutputBuffer();
+
+    void attachBudget(MemoryBudget *budget, MemoryCategory category);
+
+    void append(const char *data, size_t len);
+    void append(const std::string &str);
+    void append(const char *str);
+    void append(char c);
+    void appendNumber(long n);
+
+    const char *data() const;   // 未送信データの先頭
+    size_t size() const;        // 未送信データのバイト数
+    bool empty() const;
+    size_t capacity() const;
+    void consume(size_t len);   // 送信できた分を捨てる
+    void clear();
+    void shrink();              // 空で初めの容量より大きければ領域を返す
+};
+
+/**
+ * @brief サーバーが返す数値リプライ（RFC 2812）。
+ */
+enum ReplyCode {
+    RPL_WELCOME           = 1,
+    RPL_ENDOFSTATS        = 219,
+    RPL_STATSDEBUG        = 249,
+    RPL_ENDOFWHO          = 315,
+    RPL_LISTSTART         = 321,
+    RPL_LIST              = 322,
+    RPL_LISTEND           = 323,
+    RPL_CHANNELMODEIS     = 324,
+    RPL_NOTOPIC           = 331,
+    RPL_TOPIC             = 332,
+    RPL_INVITING          = 341,
+    RPL_WHOREPLY          = 352,
+    RPL_NAMREPLY          = 353,
+    RPL_ENDOFNAMES        = 366,
+    RPL_BANLIST           = 367,
+    RPL_ENDOFBANLIST      = 368,
+    ERR_NOSUCHNICK        = 401,
+    ERR_NOSUCHCHANNEL     = 403,
+    ERR_CANNOTSENDTOCHAN  = 404,
+    ERR_NORECIPIENT       = 411,
+    ERR_NOTEXTTOSEND      = 412,
+    ERR_INPUTTOOLONG      = 417,
+    ERR_UNKNOWNCOMMAND    = 421,
+    ERR_NONICKNAMEGIVEN   = 431,
+    ERR_NICKNAMEINUSE     = 433,
+    ERR_USERNOTINCHANNEL  = 441,
+    ERR_NOTONCHANNEL      = 442,
+    ERR_NOTREGISTERED     = 451,
+    ERR_NEEDMOREPARAMS    = 461,
+    ERR_ALREADYREGISTRED  = 462,
+    ERR_PASSWDMISMATCH    = 464,
+    ERR_CHANNELISFULL     = 471,
+    ERR_UNKNOWNMODE       = 472,
+    ERR_INVITEONLYCHAN    = 473,
+    ERR_BANNEDFROMCHAN    = 474,
+    ERR_BADCHANNELKEY     = 475,
+    ERR_CHANOPRIVSNEEDED  = 482
+};
+
+// ReplyCode の数。reply.cpp の REPLY_TEMPLATES と数が合わなければコンパイルが通らない
+static const size_t REPLY_CODE_COUNT = 37;
+
+/**
+ * @brief クライアントを発信元として中継するコマンド。
+ */
+enum MessageCode {
+    MSG_NICK,
+    MSG_JOIN,
+    MSG_PART,
+    MSG_QUIT,
+    MSG_PRIVMSG,
+    MSG_KICK,
+    MSG_INVITE,
+    MSG_TOPIC,
+    MSG_MODE,
+    MSG_CODE_COUNT
+};
+
+/**
+ * @brief 発信元プレフィックス（:nick!user@host）を構成する情報。
+ */
+struct MessageSource {
+    const std::string &nick;
+    const std::string &user;
+    const std::string &host;
+
+    MessageSource(const std::string &n, const std::string &u, const std::string &h)
+        : nick(n), user(u), host(h) {}
+};
+
+extern const std::string NO_ARG;  // 省略された引数を表す空文字列
+
+// 数値リプライ ":ircserv <code> <target> ..." を出力領域に直接書き込む
+void formatReply(OutputBuffer &out, ReplyCode code, const std::string &target,
+                 const std::string &arg1 = NO_ARG, const std::string &arg2 = NO_ARG,
+                 const std::string &arg3 = NO_ARG);
+
+// 中継メッセージ ":nick!user@host <command> ..." を出力領域に直接書き込む
+void formatMessage(OutputBuffer &out, const MessageSource &source, MessageCode code,
+                   const std::string &arg1 = NO_ARG, const std::string &arg2 = NO_ARG,
+                   const std::string &arg3 = NO_ARG);
+
+#endif // REPLY_HPP
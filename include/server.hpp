@@ -4,22 +4,57 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "channel.hpp"
+#include "reply.hpp"
+#include "channel_index.hpp"
+#include "memory_budget.hpp"
+#include "config.hpp"
+#include "transport.hpp"
+#include "flight_recorder.hpp"
+#include "websocket.hpp"
+
+/**
+ * @brief 接続登録（ハンドシェイク）の状態。
+ *
+ * PASS → NICK/USER の順に遷移し、すべてそろった時点で REG_DONE になる。
+ * NICK/USER は PASS より先に届いてもよいが、登録完了は PASS 受理後のみ。
+ */
+enum RegistrationState {
+    REG_NEED_PASS,      // PASS 待ち
+    REG_NEED_IDENTITY,  // PASS 受理済み、NICK/USER 待ち
+    REG_DONE            // 登録完了
+};
 
 /**
  * @brief クライアントの情報を保持する構造体。
  * 
- * クライアントのニックネームとユーザー名を保持する構造体。
+ * クライアントのニックネームとユーザー名、登録状態を保持する構造体。
  */
 struct ClientInfo {
     std::string nickname;
     std::string username;
-    bool authenticated;  // 認証完了したかどうかのフラグ
-    bool password_sent;  // パスワードプロンプトを送信済みかのフラグ
+    std::string realname;
+    std::string hostname;
+    RegistrationState state;  // ハンドシェイクの進行状態
+    bool quitting;            // 送信待ちを送り切ったら切断する
+    bool discarding_line;     // 長すぎる行を次の改行まで読み捨てている最中
+    size_t chat_dropped;      // 送信待ちがあふれて捨てたチャネル発言の行数
     
-    ClientInfo() : authenticated(false), password_sent(false) {}
+    ClientInfo() : state(REG_NEED_PASS), quitting(false), discarding_line(false), chat_dropped(0) {}
+
+    bool isRegistered() const { return state == REG_DONE; }
+};
+
+/**
+ * @brief 待ち受けソケット。
+ */
+struct Listener {
+    int fd;
+    int family;             // AF_INET / AF_INET6 / AF_UNIX
+    ListenAddress address;
 };
 
 /**
@@ -29,41 +64,104 @@ struct ClientInfo {
  */
 class Server {
 private:
+    static const size_t CONNECTION_OVERHEAD;
     int _port;                              // サーバーがリスニングするポート番号
     std::string _password;                  // 接続時に必要なパスワード
-    int _server_fd;                         // サーバーソケットのファイルディスクリプタ
+    std::string _config_path;               // 設定ファイルのパス（空なら既定値）
+    ServerConfig _config;                   // 現在の設定
+    std::vector<Listener> _listeners;       // 待ち受けソケット
+    SocketTransport _socketTransport;       // 既定の読み書き先（実ソケット）
+    Transport *_transport;                  // 接続への読み書きはすべてここを通す
+    ServerLimits _limits;                   // 行長・送信待ち・メモリ予算の上限
+    MemoryBudget _memory;                   // 区分ごとのメモリ使用量（出力領域より先に構築し、後に破棄する）
     std::vector<int> _client_fds;           // 接続中のクライアントソケットのファイルディスクリプタ
+    std::vector<char> _recvBuffer;          // recv の読み込み先（recv_buffer_size の大きさ）
     fd_set _read_fds;                       // `select` 用の読み取りセット
     fd_set _write_fds;                      // 書き込みセット（必要に応じて使用）
     std::map<int, ClientInfo> _clients;     // クライアント情報を管理するデータ構造
+    std::map<std::string, int> _nicknames;  // 登録済みクライアントのニックネーム -> fd（登録前の接続は含めない）
     std::map<std::string, Channel> _channels;    // チャネルを管理するデータ構造
+    ChannelIndex _channelIndex;                  // LIST 検索用の名前・メンバー数インデックス
     std::map<int, std::string> _clientBuffers;   // 各クライアントで受信途中のデータを保持
+    std::map<int, OutputBuffer> _clientOutputs;  // 各クライアントへの送信待ちデータ（応答・制御。先に送る）
+    std::map<int, OutputBuffer> _chatOutputs;    // チャネル発言の送信待ち（制御が空のときだけ送る。あふれたら捨てる）
+    std::map<int, WebSocketSession> _websockets; // WebSocket の待ち受けから来たクライアントのフレーム処理
+    OutputBuffer _broadcastBuffer;               // チャネル宛てメッセージを一度だけ整形するための作業領域
+    FlightRecorder _recorder;                    // 直近のループの記録（SIGUSR1 や遅い回で書き出す）
+    size_t _flightDumps;                         // 書き出した回数（ファイル名の通し番号）
+    long long _lastSlowDump;                     // 遅い回で最後に書き出した時刻
+    int _pinnedCpu;                              // このサーバーがイベントループを固定した CPU（-1 は固定していない）
 
     // 内部メソッド
-    void acceptClient();                       // 新しいクライアント接続を受け入れる
+    bool openListener(const ListenAddress &address);  // 待ち受けソケットを開く
+    void applyConfig(const ServerConfig &config);     // 設定を反映する（既存の接続は維持）
+    void reloadConfig();                              // 設定ファイルを読み直す（SIGHUP）
+    void dumpFlightRecorder(const std::string &reason);  // 記録をファイルに書き出す（SIGUSR1）
+    void dumpSlowIteration();                         // 遅い回の記録を間隔を空けて書き出す
+    void closeListener(const Listener &listener);     // 待ち受けソケットを閉じる
+    void acceptClient(const Listener &listener);      // 新しいクライアント接続を受け入れる
     void handleClient(int client_fd);          // クライアントからのデータを処理
     void removeClient(int client_fd);          // クライアント接続を切断し管理から削除
-    bool authenticateClient(int client_fd);    // クライアントの認証を行う
+    void flushClient(int client_fd);           // 送信待ちデータを書き込めるだけ送る
+    void flushWebSocket(int client_fd, WebSocketSession &session, OutputBuffer &out, OutputBuffer &chat);  // 行をフレームにして送る
+    void enforceLimits();                      // 送信待ちの上限・メモリ予算を超えた接続を切断する
+    void reapClients();                        // 送信待ちを送り切った切断予定の接続を閉じる
+    void accountChannel(Channel &channel);     // チャネルのメモリ使用量を予算に申告し直す
+    void accountWebSocket(WebSocketSession &session);  // WebSocket のバッファを予算に申告し直す
+    OutputBuffer &outputOf(int client_fd);     // クライアントの出力領域
+    OutputBuffer &chatOf(int client_fd);       // クライアントのチャネル発言用の出力領域
+    void trimChat(int client_fd);              // チャネル発言の送信待ちを上限まで古い行から捨てる
+    MessageSource sourceOf(int client_fd);     // クライアントを発信元とするプレフィックス
+    int findClientFd(const std::string &nickname) const;
+    void broadcast(const Channel &channel, int except_fd);  // _broadcastBufferの内容をメンバーへ配る
+    void processCommand(int client_fd, const std::string &line); // 1行分のコマンドを解析・実行
+    void completeRegistration(int client_fd);  // 条件がそろえば登録を完了させる
 
     // IRCコマンドハンドラ
+    void handlePassCommand(int client_fd, const std::string &password);
     void handleNickCommand(int client_fd, const std::string &nickname); 
-    void handleUserCommand(int client_fd, const std::string &username);
-    void handleJoinCommand(int client_fd, const std::string &channel_name, const std::string &password);
-    void handlePrivmsgCommand(int client_fd, const std::string &target, const std::string &message);
-    void handleKickCommand(int client_fd, const std::string &channel_name, const std::string &target_nickname);
+    void handleUserCommand(int client_fd, const std::string &username, const std::string &realname);
+    void handleJoinCommand(int client_fd, const std::string &channel_list, const std::string &key_list);
+    void handlePrivmsgCommand(int client_fd, const std::string &target_list, const std::string &message);
+    void handleKickCommand(int client_fd, const std::string &channel_name, const std::string &target_nickname, const std::string &reason);
     void handleModeCommand(int client_fd, const std::string &channel_name, const std::string &mode, const std::string &parameter);
     void handleInviteCommand(int client_fd, const std::string &target_nickname, const std::string &channel_name);
     void handleTopicCommand(int client_fd, const std::string &channel_name, const std::string &new_topic);
+    void handlePartCommand(int client_fd, const std::string &channel_list, const std::string &reason);
+    void handleQuitCommand(int client_fd, const std::string &reason);
+    void handleNamesCommand(int client_fd, const std::string &channel_list);
+    void handleWhoCommand(int client_fd, const std::string &mask);
+    void handleListCommand(int client_fd, const std::string &channel_list);
+    void handleStatsCommand(int client_fd, const std::string &query);
 
     // チャネル関連メソッド
     void createChannel(const std::string &channel_name, int client_fd);  
-    void joinChannel(int client_fd, const std::string &channel_name);    
+    void joinOneChannel(int client_fd, const std::string &channel_name, const std::string &password);
+    void joinChannel(int client_fd, const std::string &channel_name);
     void inviteUser(int client_fd, const std::string &channel_name, const std::string &target_nickname);
+    void destroyChannel(const std::string &channel_name);                 // 空になったチャネルを破棄
+    void leaveAllChannels(int client_fd, const std::string &reason);      // 切断時に全チャネルから抜ける
+
+    // NAMES/WHO/LIST の応答キャッシュ（無効化されていれば描き直す。NAMES/WHO は変わった人の分だけ直す）
+    const std::vector<std::string> &renderNames(Channel &channel);
+    const std::vector<std::string> &renderWho(Channel &channel);
+    std::string namesToken(const Channel &channel, int client_fd);
+    std::string whoLine(const Channel &channel, int client_fd);
+    const Channel::ReplyCache &renderList(Channel &channel);
+    void sendNames(int client_fd, Channel &channel);
 
 public:
-    Server(int port, const std::string &password);
+    Server(int port, const std::string &password, const std::string &config_path = "");
+    Server(const std::string &password, Transport &transport);  // 待ち受けを持たず、外から駆動する
     ~Server();
 
+    // 接続を1つずつ駆動する口。メインループも、MemoryTransport で動かすベンチマークもこれを使う
+    void attachConnection(int fd, const std::string &hostname);  // 受け付けた接続を登録する
+    void onReadable(int fd);           // 読み取り可能になった接続を処理する
+    void onWritable(int fd);           // 送信待ちを書き出す
+    void finishIteration();            // 上限の確認と切断予定の接続の後始末
+    bool hasPendingOutput(int fd) const;
+
     void start();                      // サーバーを起動してメインループに入る
     void shutdown();                   // サーバーを停止する（未実装の場合は将来拡張用）
     void logError(const std::string &message); // エラーログを出力する（未実装の場合は将来拡張用）
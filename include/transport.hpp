@@ -0,0 +1,73 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <string>
+#include <map>
+#include <cstddef>
+#include <sys/types.h>
+
+/**
+ * @brief 接続への読み書きを担う層。サーバーはこの口を通してのみバイト列をやり取りする。
+ *
+ * 戻り値と errno の扱いは recv/send と同じ（読むものがなければ -1 と EAGAIN、相手が閉じたら 0）。
+ * 実ソケット用の SocketTransport と、カーネルを介さない MemoryTransport がある。
+ */
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual ssize_t receive(int fd, char *buffer, size_t length) = 0;
+    virtual ssize_t transmit(int fd, const char *data, size_t length) = 0;
+    virtual void disconnect(int fd) = 0;
+};
+
+/**
+ * @brief ノンブロッキングソケットに recv/send/close をそのまま呼ぶ。
+ */
+class SocketTransport : public Transport {
+public:
+    virtual ssize_t receive(int fd, char *buffer, size_t length);
+    virtual ssize_t transmit(int fd, const char *data, size_t length);
+    virtual void disconnect(int fd);
+};
+
+/**
+ * @brief メモリ上の接続。ベンチマークや動作確認でサーバーを直接駆動するために使う。
+ *
+ * open() で仮想の fd を作り、deliver() でクライアントからの入力を積み、
+ * サーバーが送った内容は sent() で取り出す。仮想の fd は実在の fd と重ならない番号から振る。
+ */
+class MemoryTransport : public Transport {
+private:
+    struct Connection {
+        std::string inbound;    // クライアント -> サーバー（未読分）
+        std::string outbound;   // サーバー -> クライアント
+        bool peer_closed;       // クライアント側が閉じた（読み切ったら 0 を返す）
+        bool open;              // サーバー側がまだ閉じていない
+
+        Connection() : peer_closed(false), open(true) {}
+    };
+
+    std::map<int, Connection> _connections;
+    int _next_fd;
+    size_t _write_limit;        // 1回の transmit で受け取る最大バイト数（0 は無制限）
+
+public:
+    static const int FIRST_FD = 1 << 20;
+
+    MemoryTransport();
+
+    int open();
+    void deliver(int fd, const std::string &data);
+    void hangup(int fd);
+    std::string &sent(int fd);
+    size_t pendingInput(int fd) const;
+    bool isOpen(int fd) const;
+    void setWriteLimit(size_t bytes);   // 送信の詰まり（部分書き込み）を再現する
+
+    virtual ssize_t receive(int fd, char *buffer, size_t length);
+    virtual ssize_t transmit(int fd, const char *data, size_t length);
+    virtual void disconnect(int fd);
+};
+
+#endif // TRANSPORT_HPP
@@ -0,0 +1,96 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <string>
+#include <cstddef>
+
+// SHA-1 のダイジェスト（20バイト）を返す
+std::string sha1(const std::string &data);
+std::string base64Encode(const std::string &data);
+// Sec-WebSocket-Key から Sec-WebSocket-Accept の値を作る（RFC 6455 4.2.2）
+std::string websocketAcceptKey(const std::string &key);
+
+/**
+ * @brief UTF-8 を1バイトずつ検査する（RFC 3629。過長な表現・サロゲート・U+10FFFF を超える値は不正）。
+ *        フレームの途中で文字が区切られていても、状態を持ち越して続きから検査できる。
+ */
+class Utf8Validator {
+private:
+    size_t _need;         // 今の文字の残りのバイト数
+    unsigned char _low;   // 次のバイトとして許される範囲
+    unsigned char _high;
+
+public:
+    Utf8Validator();
+
+    bool feed(unsigned char byte);  // 不正なバイトなら false（状態はそのまま。reset してから使い直す）
+    bool complete() const;          // 文字の途中でなければ true
+    void reset();
+};
+
+/**
+ * @brief WebSocket 接続1本ぶんの状態（RFC 6455 のサーバー側）。
+ *
+ * 受信したバイト列から HTTP の Upgrade 要求を読んで 101 応答を作り、以降はフレームを解いて
+ * マスクを外した本文を取り出す。本文はそのまま通常の行の切り出しに流すため、
+ * 1つのメッセージが改行で終わっていなければ末尾に改行を補う。
+ * テキストフレームの本文は UTF-8 でなければならないので、受信では検査して不正なら 1007 で閉じ、
+ * 送信では不正なバイト列を U+FFFD に置き換える（binary.ircv3.net ならバイナリフレームでそのまま送る）。
+ * 送信側は IRC の1行を1フレーム（行末の CRLF は付けない）にする。
+ * ハンドシェイク応答・pong・close などの制御用の送信データと、フレーム化した行はどちらも outbound() にたまる。
+ * 行は1回に FRAME_BATCH バイトほどずつフレームにし、送信待ちの大部分は呼び出し側の出力領域に残す。
+ */
+class WebSocketSession {
+public:
+    enum State {
+        WS_HANDSHAKE,   // Upgrade 要求を待っている
+        WS_OPEN,        // フレームをやり取りしている
+        WS_CLOSED       // close を送った（あとは outbound を送り切って切断する）
+    };
+
+    static const size_t MAX_HANDSHAKE = 8192;      // HTTP 要求の上限
+    static const size_t MAX_FRAME_PAYLOAD = 65536; // 1フレームの本文の上限
+    static const size_t FRAME_BATCH = 16384;       // frameLines が1回にフレームにする量の目安
+
+private:
+    State _state;
+    std::string _inbound;            // 未処理の受信データ
+    std::string _outbound;           // 送信待ち（フレーム化済み）
+    bool _binary;                    // binary.ircv3.net を選んだ（送信をバイナリフレームにする）
+    bool _messageOpen;               // 分割されたメッセージの途中
+    bool _endsWithNewline;           // 直前に本文として渡した最後の文字が改行だった
+    bool _textMessage;               // 受信途中のメッセージがテキスト（UTF-8 を検査する）
+    Utf8Validator _utf8;             // 受信途中のテキストメッセージの検査状態
+    size_t _accountedInbound;        // メモリ予算に申告済みの _inbound の大きさ
+    size_t _accountedOutbound;       // メモリ予算に申告済みの _outbound の大きさ
+
+    bool readHandshake();
+    bool readFrames(std::string &payload);
+    void reject(const char *status, const char *extra_headers);
+    void appendFrame(int opcode, const char *data, size_t length);
+    void fail(unsigned short code);
+
+public:
+    WebSocketSession();
+
+    // 受信データを渡し、IRC の行として処理すべきバイト列を payload に追加する。
+    // 切断すべきときは false（outbound に残ったものは送ってから閉じる）
+    bool receive(const char *data, size_t length, std::string &payload);
+    // data の中の改行で終わる行をフレームにして outbound に積み、消費したバイト数を返す。
+    // FRAME_BATCH バイトに達したら、残りの行は次の呼び出しに回す
+    size_t frameLines(const char *data, size_t length);
+
+    std::string &outbound();
+    bool hasOutbound() const;
+    State state() const;
+
+    // メモリ予算に申告する大きさ（_inbound は受信バッファ、_outbound は送信待ちとして数える）と、申告済みの値
+    size_t inboundCapacity() const;
+    size_t outboundCapacity() const;
+    size_t accountedInbound() const;
+    size_t accountedOutbound() const;
+    void setAccounted(size_t inbound, size_t outbound);
+    void shrink();  // 空になったバッファの大きな領域を返す
+};
+
+#endif // WEBSOCKET_HPP
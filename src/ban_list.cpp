@@ -0,0 +1,336 @@
+#include "../include/ban_list.hpp"
+#include <cctype>
+
+/**
+ * @brief 照合は大文字・小文字を区別しないため、マスクも照合対象も小文字にそろえる。
+ */
+static std::string toLower(const std::string &str) {
+    std::string lowered(str);
+    for (size_t i = 0; i < lowered.size(); ++i) {
+        lowered[i] = std::tolower(static_cast<unsigned char>(lowered[i]));
+    }
+    return lowered;
+}
+
+/**
+ * @brief str の pos から固定片 segment が一致するか（'?' は任意の1文字）。
+ */
+static bool segmentAt(const std::string &str, size_t pos, const std::string &segment) {
+    if (pos + segment.size() > str.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < segment.size(); ++i) {
+        if (segment[i] != '?' && segment[i] != str[pos + i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BanList::Glob::Glob(const std::string &pattern)
+    : leading_star(!pattern.empty() && pattern[0] == '*'),
+      trailing_star(!pattern.empty() && pattern[pattern.size() - 1] == '*') {
+    size_t start = 0;
+    while (start <= pattern.size()) {
+        size_t star = pattern.find('*', start);
+        if (star == std::string::npos) {
+            star = pattern.size();
+        }
+        if (star > start) {
+            segments.push_back(pattern.substr(start, star - start));
+        }
+        start = star + 1;
+    }
+}
+
+/**
+ * @brief 先頭・末尾の固定片をその位置で確かめ、間の固定片は左から順に最初の一致位置を探す。
+ *        '*' の間の固定片は最左一致で取って問題ない（後ろの固定片の置き場所が減らない）ため、
+ *        バックトラックは要らない。
+ */
+bool BanList::Glob::match(const std::string &str) const {
+    if (segments.empty()) {
+        return leading_star || str.empty();
+    }
+    size_t first = 0;
+    size_t last = segments.size();
+    size_t pos = 0;
+    size_t limit = str.size();
+    if (!leading_star) {
+        if (!segmentAt(str, 0, segments[0])) {
+            return false;
+        }
+        if (segments.size() == 1 && !trailing_star) {
+            return str.size() == segments[0].size();
+        }
+        pos = segments[0].size();
+        first = 1;
+    }
+    if (!trailing_star) {
+        const std::string &tail = segments[last - 1];
+        if (str.size() < pos + tail.size() || !segmentAt(str, str.size() - tail.size(), tail)) {
+            return false;
+        }
+        limit = str.size() - tail.size();
+        --last;
+    }
+    for (size_t i = first; i < last; ++i) {
+        const std::string &segment = segments[i];
+        bool found = false;
+        for (; pos + segment.size() <= limit; ++pos) {
+            if (segmentAt(str, pos, segment)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        pos += segment.size();
+    }
+    return true;
+}
+
+std::string BanList::normalize(const std::string &mask) {
+    std::string nick = "*";
+    std::string user = "*";
+    std::string host = "*";
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@', bang == std::string::npos ? 0 : bang);
+    if (bang == std::string::npos && at == std::string::npos) {
+        // 単独の語は '.' を含めばホスト名、含まなければニックネームとみなす
+        (mask.find('.') != std::string::npos ? host : nick) = mask;
+    } else {
+        size_t user_start = 0;
+        if (bang != std::string::npos) {
+            nick = mask.substr(0, bang);
+            user_start = bang + 1;
+        }
+        if (at != std::string::npos) {
+            user = mask.substr(user_start, at - user_start);
+            host = mask.substr(at + 1);
+        } else {
+            user = mask.substr(user_start);
+        }
+    }
+    if (nick.empty()) nick = "*";
+    if (user.empty()) user = "*";
+    if (host.empty()) host = "*";
+    return toLower(nick + "!" + user + "@" + host);
+}
+
+/**
+ * @brief 鍵の種類（前方 'p' / 後方 's'）と鍵からブルームフィルタのビット位置を2つ作る（FNV-1a）。
+ */
+static void bloomPositions(char kind, const char *key, size_t length, size_t bits,
+                           size_t &first, size_t &second) {
+    unsigned long hash = 2166136261UL;
+    hash = (hash ^ static_cast<unsigned char>(kind)) * 16777619UL;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619UL;
+        hash &= 0xffffffffUL;
+    }
+    first = hash % bits;
+    second = ((hash >> 16) | (hash << 16)) % bits;
+}
+
+bool BanList::bloomMayContain(char kind, const char *key, size_t length) const {
+    size_t first;
+    size_t second;
+    bloomPositions(kind, key, length, BLOOM_BITS, first, second);
+    return _bloom.test(first) && _bloom.test(second);
+}
+
+void BanList::bloomInsert(char kind, const std::string &key) {
+    size_t first;
+    size_t second;
+    bloomPositions(kind, key.data(), key.size(), BLOOM_BITS, first, second);
+    _bloom.set(first);
+    _bloom.set(second);
+}
+
+/**
+ * @brief '*' も '?' も含まない、そのまま比べられるパターンか。
+ */
+static bool isLiteral(const std::string &pattern) {
+    return !pattern.empty() && pattern.find_first_of("*?") == std::string::npos;
+}
+
+/**
+ * @brief position 番目のマスクを、ホスト部の固定の前方部分・後方部分、
+ *        ワイルドカードのないニックネーム・ユーザー名のどれか1つで索引に載せる。
+ */
+void BanList::indexEntry(size_t position) {
+    const Glob &host = _compiled[position].host;
+    if (!host.leading_star && !host.segments.empty()) {
+        std::string prefix = host.segments.front().substr(0, host.segments.front().find('?'));
+        if (!prefix.empty()) {
+            _byPrefix[prefix].push_back(position);
+            _prefixLengths.insert(prefix.size());
+            bloomInsert('p', prefix);
+            return;
+        }
+    }
+    if (!host.trailing_star && !host.segments.empty()) {
+        const std::string &tail = host.segments.back();
+        size_t wildcard = tail.rfind('?');
+        std::string suffix = (wildcard == std::string::npos) ? tail : tail.substr(wildcard + 1);
+        if (!suffix.empty()) {
+            _bySuffix[suffix].push_back(position);
+            _suffixLengths.insert(suffix.size());
+            bloomInsert('s', suffix);
+            return;
+        }
+    }
+    const std::string &mask = _entries[position].mask;
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@', bang);
+    std::string nick = mask.substr(0, bang);
+    if (isLiteral(nick)) {
+        _byNick[nick].push_back(position);
+        return;
+    }
+    std::string user = mask.substr(bang + 1, at - bang - 1);
+    if (isLiteral(user)) {
+        _byUser[user].push_back(position);
+        return;
+    }
+    _unindexed.push_back(position);
+}
+
+void BanList::rebuildIndex() {
+    _byPrefix.clear();
+    _bySuffix.clear();
+    _prefixLengths.clear();
+    _suffixLengths.clear();
+    _byNick.clear();
+    _byUser.clear();
+    _unindexed.clear();
+    _bloom.reset();
+    for (size_t i = 0; i < _compiled.size(); ++i) {
+        indexEntry(i);
+    }
+}
+
+bool BanList::add(const std::string &mask, const std::string &setter, time_t set_at) {
+    std::string normalized = normalize(mask);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].mask == normalized) {
+            return false;
+        }
+    }
+    Entry entry;
+    entry.mask = normalized;
+    entry.setter = setter;
+    entry.set_at = set_at;
+    _entries.push_back(entry);
+
+    size_t bang = normalized.find('!');
+    size_t at = normalized.find('@', bang);
+    CompiledMask compiled;
+    compiled.nick = Glob(normalized.substr(0, bang));
+    compiled.user = Glob(normalized.substr(bang + 1, at - bang - 1));
+    compiled.host = Glob(normalized.substr(at + 1));
+    _compiled.push_back(compiled);
+    indexEntry(_compiled.size() - 1);
+    return true;
+}
+
+/**
+ * @brief マスクを外す。ブルームフィルタからは個別に消せないため、索引は作り直す。
+ */
+bool BanList::remove(const std::string &mask) {
+    std::string normalized = normalize(mask);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].mask == normalized) {
+            _entries.erase(_entries.begin() + i);
+            _compiled.erase(_compiled.begin() + i);
+            rebuildIndex();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BanList::matchCandidates(const std::vector<size_t> &candidates, const std::string &nick,
+                              const std::string &user, const std::string &host) const {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const CompiledMask &mask = _compiled[candidates[i]];
+        if (mask.host.match(host) && mask.user.match(user) && mask.nick.match(nick)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BanList::matchKey(const KeyIndex &index, const std::string &key, const std::string &nick,
+                       const std::string &user, const std::string &host) const {
+    KeyIndex::const_iterator bucket = index.find(key);
+    return bucket != index.end() && matchCandidates(bucket->second, nick, user, host);
+}
+
+/**
+ * @brief nick!user@host がいずれかのマスクに一致するか。
+ *        ホスト名から索引にある長さの前方・後方部分だけを切り出して引くため、
+ *        マスクの数ではなく鍵の長さの種類の数に比例した手間で済む。
+ *        ニックネーム・ユーザー名の鍵はそのまま1回ずつ引く。
+ */
+bool BanList::matches(const std::string &nick, const std::string &user, const std::string &host) const {
+    if (_entries.empty()) {
+        return false;
+    }
+    std::string lnick = toLower(nick);
+    std::string luser = toLower(user);
+    std::string lhost = toLower(host);
+
+    if (matchCandidates(_unindexed, lnick, luser, lhost) || matchKey(_byNick, lnick, lnick, luser, lhost) ||
+        matchKey(_byUser, luser, lnick, luser, lhost)) {
+        return true;
+    }
+    for (std::set<size_t>::const_iterator it = _prefixLengths.begin();
+         it != _prefixLengths.end() && *it <= lhost.size(); ++it) {
+        if (!bloomMayContain('p', lhost.data(), *it)) {
+            continue;
+        }
+        KeyIndex::const_iterator bucket = _byPrefix.find(lhost.substr(0, *it));
+        if (bucket != _byPrefix.end() && matchCandidates(bucket->second, lnick, luser, lhost)) {
+            return true;
+        }
+    }
+    for (std::set<size_t>::const_iterator it = _suffixLengths.begin();
+         it != _suffixLengths.end() && *it <= lhost.size(); ++it) {
+        size_t start = lhost.size() - *it;
+        if (!bloomMayContain('s', lhost.data() + start, *it)) {
+            continue;
+        }
+        KeyIndex::const_iterator bucket = _bySuffix.find(lhost.substr(start));
+        if (bucket != _bySuffix.end() && matchCandidates(bucket->second, lnick, luser, lhost)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<BanList::Entry> &BanList::entries() const {
+    return _entries;
+}
+
+size_t BanList::size() const {
+    return _entries.size();
+}
+
+/**
+ * @brief マスク本体・コンパイル結果・索引のおおよそのバイト数。
+ */
+size_t BanList::memoryFootprint() const {
+    static const size_t NODE_BYTES = 48;
+    size_t bytes = _entries.capacity() * sizeof(Entry) + _compiled.capacity() * sizeof(CompiledMask);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        bytes += 2 * (_entries[i].mask.capacity() + _entries[i].setter.capacity());
+    }
+    bytes += (_byPrefix.size() + _bySuffix.size() + _byNick.size() + _byUser.size()) *
+             (NODE_BYTES + sizeof(std::vector<size_t>));
+    bytes += (_prefixLengths.size() + _suffixLengths.size()) * NODE_BYTES;
+    bytes += (_entries.size() + _unindexed.capacity()) * sizeof(size_t);
+    return bytes;
+}
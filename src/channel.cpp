@@ -1,11 +1,13 @@
 #include "../include/channel.hpp"
 #include <algorithm>
 
+static const size_t SET_NODE_BYTES = 48;  // set/map の木のノード1個ぶんの概算
+
 // コンストラクタでトピックを初期化
-Channel::Channel() : _name(""), _topic(""), _user_limit(0) {}
+Channel::Channel() : _name(""), _topic(""), _user_limit(0), _accounted_bytes(0) {}
 
 Channel::Channel(const std::string &name)
-    : _name(name), _topic(""), _user_limit(0) {}
+    : _name(name), _topic(""), _user_limit(0), _accounted_bytes(0) {}
 
 Channel::~Channel() {}
 
@@ -20,27 +22,42 @@ const std::string& Channel::getTopic() const {
 
 void Channel::setTopic(const std::string &topic) {
     _topic = topic;
+    _list_cache.invalidate();
 }
 
 void Channel::addClient(int client_fd) {
     _client_fds.push_back(client_fd);
     _invitees.erase(client_fd);
+    _names_cache.touch(client_fd);
+    _who_cache.touch(client_fd);
+    _list_cache.invalidate();
 }
 
+// 退出したFDは別の接続に再利用されるため、オペレーター権限も外す
 void Channel::removeClient(int client_fd) {
     _client_fds.erase(std::remove(_client_fds.begin(), _client_fds.end(), client_fd), _client_fds.end());
+    _operators.erase(client_fd);
+    _names_cache.remove(client_fd);
+    _who_cache.remove(client_fd);
+    _list_cache.invalidate();
 }
 
 const std::vector<int>& Channel::getClients() const {
     return _client_fds;
 }
 
+bool Channel::hasClient(int client_fd) const {
+    return std::find(_client_fds.begin(), _client_fds.end(), client_fd) != _client_fds.end();
+}
+
 void Channel::addOperator(int client_fd) {
     _operators.insert(client_fd);
+    touchMember(client_fd);
 }
 
 void Channel::removeOperator(int client_fd) {
     _operators.erase(client_fd);
+    touchMember(client_fd);
 }
 
 bool Channel::isOperator(int client_fd) const {
@@ -49,10 +66,12 @@ bool Channel::isOperator(int client_fd) const {
 
 void Channel::addMode(char mode) {
     _modes.insert(mode);
+    _list_cache.invalidate();
 }
 
 void Channel::removeMode(char mode) {
     _modes.erase(mode);
+    _list_cache.invalidate();
 }
 
 bool Channel::hasMode(char mode) const {
@@ -67,6 +86,22 @@ bool Channel::isInvitee(int client_fd) const {
     return _invitees.find(client_fd) != _invitees.end();
 }
 
+bool Channel::addBan(const std::string &mask, const std::string &setter) {
+    return _bans.add(mask, setter, std::time(NULL));
+}
+
+bool Channel::removeBan(const std::string &mask) {
+    return _bans.remove(mask);
+}
+
+bool Channel::isBanned(const std::string &nick, const std::string &user, const std::string &host) const {
+    return _bans.matches(nick, user, host);
+}
+
+const std::vector<BanList::Entry>& Channel::getBans() const {
+    return _bans.entries();
+}
+
 
 void Channel::setPassword(const std::string &password) {
     _password = password;
@@ -103,4 +138,187 @@ bool Channel::isUserLimitReached() const {
     }
     // 現在のユーザー数が制限以上なら、制限に達している
     return static_cast<int>(_client_fds.size()) >= _user_limit;
-}
\ No newline at end of file
+}
+
+Channel::MemberReplyCache &Channel::namesCache() {
+    return _names_cache;
+}
+
+Channel::MemberReplyCache &Channel::whoCache() {
+    return _who_cache;
+}
+
+Channel::ReplyCache &Channel::listCache() {
+    return _list_cache;
+}
+
+// メンバーでない fd に印を付けると、描き直しで NAMES/WHO に加わってしまうので付けない
+void Channel::touchMember(int client_fd) {
+    if (!hasClient(client_fd)) {
+        return;
+    }
+    _names_cache.touch(client_fd);
+    _who_cache.touch(client_fd);
+}
+
+/**
+ * @brief チャネルが使っているメモリの概算。set の要素は木のノード1個ぶんとして数える。
+ */
+size_t Channel::memoryFootprint() const {
+    size_t bytes = sizeof(Channel) + _name.capacity() + _topic.capacity() + _password.capacity();
+    bytes += _client_fds.capacity() * sizeof(int);
+    bytes += (_operators.size() + _modes.size() + _invitees.size()) * SET_NODE_BYTES;
+    bytes += _bans.memoryFootprint();
+    bytes += _names_cache.memoryFootprint() + _who_cache.memoryFootprint();
+    bytes += _list_cache.lines.capacity() * sizeof(std::string);
+    for (size_t i = 0; i < _list_cache.lines.size(); ++i) {
+        bytes += _list_cache.lines[i].capacity();
+    }
+    return bytes;
+}
+
+size_t Channel::getAccountedBytes() const {
+    return _accounted_bytes;
+}
+
+void Channel::setAccountedBytes(size_t bytes) {
+    _accounted_bytes = bytes;
+}
+
+Channel::MemberReplyCache::MemberReplyCache() : _max_line(0), _bytes(0), _valid(false) {}
+
+bool Channel::MemberReplyCache::valid() const {
+    return _valid;
+}
+
+void Channel::MemberReplyCache::reset(const std::string &header, size_t max_line) {
+    invalidate();
+    _header = header;
+    _max_line = max_line;
+    _valid = true;
+}
+
+void Channel::MemberReplyCache::invalidate() {
+    std::vector<std::string>().swap(_lines);
+    std::vector<std::vector<int> >().swap(_line_members);
+    _slots.clear();
+    _stale.clear();
+    _bytes = 0;
+    _valid = false;
+}
+
+// 無効なキャッシュは次の問い合わせで全員ぶん描くので、印を付けなくてよい
+void Channel::MemberReplyCache::touch(int client_fd) {
+    if (_valid) {
+        _stale.insert(client_fd);
+    }
+}
+
+void Channel::MemberReplyCache::remove(int client_fd) {
+    _stale.erase(client_fd);
+    std::map<int, Slot>::iterator it = _slots.find(client_fd);
+    if (it == _slots.end()) {
+        return;
+    }
+    size_t line = it->second.line;
+    _bytes -= it->second.token.size();
+    _slots.erase(it);
+    unplace(client_fd, line);
+}
+
+/**
+ * @brief 1人ぶんの表示を入れ替える。新しいメンバーは最後の行に足す。
+ *        表示が長くなって行に収まらなくなったら、その人だけを最後の行へ移す。
+ */
+void Channel::MemberReplyCache::set(int client_fd, const std::string &token) {
+    _stale.erase(client_fd);
+    std::map<int, Slot>::iterator it = _slots.find(client_fd);
+    if (it == _slots.end()) {
+        Slot &slot = _slots[client_fd];
+        slot.token = token;
+        _bytes += token.size();
+        place(client_fd, slot);
+        return;
+    }
+    Slot &slot = it->second;
+    if (slot.token == token) {
+        return;
+    }
+    _bytes -= slot.token.size();
+    _bytes += token.size();
+    slot.token = token;
+    redraw(slot.line);
+    if (_lines[slot.line].size() > _max_line && _line_members[slot.line].size() > 1) {
+        unplace(client_fd, slot.line);
+        place(client_fd, slot);
+    }
+}
+
+const std::set<int> &Channel::MemberReplyCache::stale() const {
+    return _stale;
+}
+
+const std::vector<std::string> &Channel::MemberReplyCache::lines() const {
+    return _lines;
+}
+
+size_t Channel::MemberReplyCache::memoryFootprint() const {
+    return _header.capacity() + _bytes
+         + _lines.capacity() * sizeof(std::string)
+         + _line_members.capacity() * sizeof(std::vector<int>) + _slots.size() * sizeof(int)
+         + (_slots.size() + _stale.size()) * SET_NODE_BYTES;
+}
+
+// 最後の行に収まればそこへ足し、収まらなければ新しい行を始める
+void Channel::MemberReplyCache::place(int client_fd, Slot &slot) {
+    if (!_lines.empty() && _lines.back().size() + 1 + slot.token.size() <= _max_line) {
+        slot.line = _lines.size() - 1;
+        _line_members.back().push_back(client_fd);
+        _lines.back() += ' ';
+        _lines.back() += slot.token;
+        _bytes += 1 + slot.token.size();
+        return;
+    }
+    slot.line = _lines.size();
+    _lines.push_back(_header + slot.token);
+    _line_members.push_back(std::vector<int>(1, client_fd));
+    _bytes += _lines.back().size();
+}
+
+// 行からメンバーを外す。行が空になったら最後の行をその位置へ移して詰める
+void Channel::MemberReplyCache::unplace(int client_fd, size_t line) {
+    std::vector<int> &members = _line_members[line];
+    members.erase(std::find(members.begin(), members.end(), client_fd));
+    if (!members.empty()) {
+        redraw(line);
+        return;
+    }
+    _bytes -= _lines[line].size();
+    size_t last = _lines.size() - 1;
+    if (line != last) {
+        _lines[line].swap(_lines[last]);
+        _line_members[line].swap(_line_members[last]);
+        for (size_t i = 0; i < _line_members[line].size(); ++i) {
+            std::map<int, Slot>::iterator it = _slots.find(_line_members[line][i]);
+            if (it != _slots.end()) {
+                it->second.line = line;
+            }
+        }
+    }
+    _lines.pop_back();
+    _line_members.pop_back();
+}
+
+void Channel::MemberReplyCache::redraw(size_t line) {
+    std::string &text = _lines[line];
+    const std::vector<int> &members = _line_members[line];
+    _bytes -= text.size();
+    text = _header;
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (i > 0) {
+            text += ' ';
+        }
+        text += _slots.find(members[i])->second.token;
+    }
+    _bytes += text.size();
+}
@@ -0,0 +1,130 @@
+#include "../include/channel_index.hpp"
+#include <limits>
+
+/**
+ * @brief * は任意の文字列、? は任意の1文字に一致する。最後の * の位置に戻りながら照合する。
+ */
+bool matchWildcard(const std::string &pattern, const std::string &str) {
+    size_t p = 0;
+    size_t s = 0;
+    size_t star = std::string::npos;  // 最後に見た * の位置
+    size_t resume = 0;                // その * に吸わせた直後の str 位置
+    while (s < str.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+            ++p;
+            ++s;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = s;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            s = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+static std::string reversed(const std::string &str) {
+    return std::string(str.rbegin(), str.rend());
+}
+
+ChannelIndex::Query::Query()
+    : min_members(0), max_members(std::numeric_limits<size_t>::max()) {}
+
+void ChannelIndex::insert(const std::string &name, size_t members) {
+    if (_sizes.find(name) != _sizes.end()) {
+        update(name, members);
+        return;
+    }
+    _sizes[name] = members;
+    _reversed.insert(reversed(name));
+    _bySize.insert(SizeKey(members, name));
+}
+
+void ChannelIndex::erase(const std::string &name) {
+    std::map<std::string, size_t>::iterator it = _sizes.find(name);
+    if (it == _sizes.end()) {
+        return;
+    }
+    _bySize.erase(SizeKey(it->second, name));
+    _reversed.erase(reversed(name));
+    _sizes.erase(it);
+}
+
+void ChannelIndex::update(const std::string &name, size_t members) {
+    std::map<std::string, size_t>::iterator it = _sizes.find(name);
+    if (it == _sizes.end()) {
+        insert(name, members);
+        return;
+    }
+    if (it->second == members) {
+        return;
+    }
+    _bySize.erase(SizeKey(it->second, name));
+    it->second = members;
+    _bySize.insert(SizeKey(members, name));
+}
+
+size_t ChannelIndex::size() const {
+    return _sizes.size();
+}
+
+/**
+ * @brief 条件に合うチャネルを探す。
+ *        パターンに固定の先頭部分か末尾部分があれば、長いほうで名前の範囲だけを走査する
+ *        （チャネル名はどれも '#' などで始まるので、"#*foo" なら末尾の "foo" のほうが絞れる）。
+ *        名前で絞れなければメンバー数の範囲だけを走査する。
+ *        どちらの絞り込みも効かない場合に限り全件を見る。
+ */
+void ChannelIndex::search(const Query &query, std::vector<std::string> &result) const {
+    const std::string &pattern = query.pattern;
+    size_t wildcard = pattern.find_first_of("*?");
+
+    // ワイルドカードなし：完全一致
+    if (!pattern.empty() && wildcard == std::string::npos) {
+        std::map<std::string, size_t>::const_iterator it = _sizes.find(pattern);
+        if (it != _sizes.end() && it->second >= query.min_members && it->second <= query.max_members) {
+            result.push_back(it->first);
+        }
+        return;
+    }
+
+    // 固定の先頭部分か末尾部分があれば、長いほうの一致範囲だけを見る
+    const std::string prefix = pattern.substr(0, wildcard);
+    const std::string suffix = pattern.empty() ? std::string() : pattern.substr(pattern.find_last_of("*?") + 1);
+    if (suffix.size() > prefix.size()) {
+        const std::string key = reversed(suffix);
+        for (std::set<std::string>::const_iterator it = _reversed.lower_bound(key);
+             it != _reversed.end() && it->compare(0, key.size(), key) == 0; ++it) {
+            const std::string name = reversed(*it);
+            size_t members = _sizes.find(name)->second;
+            if (members >= query.min_members && members <= query.max_members && matchWildcard(pattern, name)) {
+                result.push_back(name);
+            }
+        }
+        return;
+    }
+    if (!prefix.empty()) {
+        for (std::map<std::string, size_t>::const_iterator it = _sizes.lower_bound(prefix);
+             it != _sizes.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (it->second >= query.min_members && it->second <= query.max_members &&
+                matchWildcard(pattern, it->first)) {
+                result.push_back(it->first);
+            }
+        }
+        return;
+    }
+
+    // 名前で絞れなければメンバー数の範囲を見る（範囲指定がなければ全件）
+    for (std::set<SizeKey>::const_iterator it = _bySize.lower_bound(SizeKey(query.min_members, std::string()));
+         it != _bySize.end() && it->first <= query.max_members; ++it) {
+        if (pattern.empty() || matchWildcard(pattern, it->second)) {
+            result.push_back(it->second);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#include "../include/config.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+
+/**
+ * @brief 前後の空白を取り除く。
+ */
+static std::string trim(const std::string &str) {
+    size_t start = str.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(start, end - start + 1);
+}
+
+static bool parseBool(const std::string &value, bool &out) {
+    if (value == "yes" || value == "on" || value == "true" || value == "1") {
+        out = true;
+        return true;
+    }
+    if (value == "no" || value == "off" || value == "false" || value == "0") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 0以上の整数を読む。k/m/g の接尾辞があれば 1024 倍単位で掛ける。
+ */
+static bool parseSize(const std::string &value, size_t &out) {
+    if (value.empty() || value[0] == '-') {
+        return false;
+    }
+    char *end = NULL;
+    errno = 0;
+    unsigned long number = std::strtoul(value.c_str(), &end, 10);
+    if (errno != 0 || end == value.c_str()) {
+        return false;
+    }
+    std::string suffix(end);
+    unsigned long mult = 1;
+    if (suffix == "k" || suffix == "K") {
+        mult = 1024UL;
+    } else if (suffix == "m" || suffix == "M") {
+        mult = 1024UL * 1024UL;
+    } else if (suffix == "g" || suffix == "G") {
+        mult = 1024UL * 1024UL * 1024UL;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    // 掛けるとあふれる値は、小さな値に化けないよう不正として扱う
+    if (number > ULONG_MAX / mult) {
+        return false;
+    }
+    out = number * mult;
+    return true;
+}
+
+static bool parseInt(const std::string &value, int &out) {
+    size_t number = 0;
+    if (!parseSize(value, number) || number > 0x7fffffffUL) {
+        return false;
+    }
+    out = static_cast<int>(number);
+    return true;
+}
+
+static bool parsePort(const std::string &value, int &port) {
+    return parseInt(value, port) && port > 0 && port <= 65535;
+}
+
+/**
+ * @brief 「アドレス」「アドレス:ポート」「[IPv6アドレス]:ポート」「unix:パス」を読む。
+ *        角かっこのない IPv6 アドレス（"::1" など）はポートを省略したものとみなす。
+ *        先頭の "ws:" は WebSocket の待ち受けを表す。
+ */
+static bool parseListenAddress(const std::string &value, int default_port, ListenAddress &out) {
+    if (value.compare(0, 3, "ws:") == 0) {
+        if (!parseListenAddress(value.substr(3), default_port, out)) {
+            return false;
+        }
+        out.websocket = true;
+        return true;
+    }
+    out = ListenAddress(value, default_port);
+    if (value.compare(0, 5, "unix:") == 0) {
+        out.host.clear();
+        out.port = 0;
+        out.path = value.substr(5);
+        return !out.path.empty();
+    }
+    if (!value.empty() && value[0] == '[') {
+        size_t close = value.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        out.host = value.substr(1, close - 1);
+        std::string rest = value.substr(close + 1);
+        if (!rest.empty() && (rest[0] != ':' || !parsePort(rest.substr(1), out.port))) {
+            return false;
+        }
+        return !out.host.empty();
+    }
+    size_t colon = value.find(':');
+    if (colon != std::string::npos && value.find(':', colon + 1) == std::string::npos) {
+        if (!parsePort(value.substr(colon + 1), out.port)) {
+            return false;
+        }
+        out.host = value.substr(0, colon);
+    }
+    return !out.host.empty();
+}
+
+std::string ListenAddress::describe() const {
+    std::ostringstream oss;
+    if (websocket) {
+        oss << "ws:";
+    }
+    if (isUnix()) {
+        oss << "unix:" << path;
+        return oss.str();
+    }
+    if (host.find(':') != std::string::npos) {
+        oss << "[" << host << "]:" << port;
+    } else {
+        oss << host << ":" << port;
+    }
+    return oss.str();
+}
+
+/**
+ * @brief 1つのキーと値を config に反映する。未知のキーや不正な値なら false。
+ */
+static bool applySetting(const std::string &key, const std::string &value, int default_port,
+                         ServerConfig &config) {
+    SocketOptions &sock = config.socket;
+    ServerLimits &limits = config.limits;
+    RecorderOptions &recorder = config.recorder;
+    PollOptions &poll = config.poll;
+
+    if (key == "bind") {
+        ListenAddress address;
+        if (!parseListenAddress(value, default_port, address)) {
+            return false;
+        }
+        config.binds.push_back(address);
+        return true;
+    }
+    if (key == "backlog")            return parseInt(value, sock.backlog);
+    if (key == "so_sndbuf")          return parseInt(value, sock.send_buffer);
+    if (key == "so_rcvbuf")          return parseInt(value, sock.recv_buffer);
+    if (key == "tcp_nodelay")        return parseBool(value, sock.tcp_nodelay);
+    if (key == "tcp_defer_accept")   return parseInt(value, sock.defer_accept);
+    if (key == "keepalive")          return parseBool(value, sock.keepalive);
+    if (key == "keepalive_idle")     return parseInt(value, sock.keepalive_idle);
+    if (key == "keepalive_interval") return parseInt(value, sock.keepalive_interval);
+    if (key == "keepalive_count")    return parseInt(value, sock.keepalive_count);
+    if (key == "so_busy_poll")       return parseInt(value, sock.busy_poll);
+    if (key == "max_line_length")    return parseSize(value, limits.max_line_length) && limits.max_line_length >= 16;
+    if (key == "max_output_queue")   return parseSize(value, limits.max_output_queue);
+    if (key == "max_chat_queue")     return parseSize(value, limits.max_chat_queue);
+    if (key == "memory_budget")      return parseSize(value, limits.memory_budget);
+    if (key == "max_connections")    return parseSize(value, limits.max_connections);
+    if (key == "recv_buffer_size")   return parseSize(value, limits.recv_buffer_size) && limits.recv_buffer_size > 0;
+    if (key == "flight_recorder_iterations") return parseSize(value, recorder.iterations);
+    if (key == "slow_iteration_ms")  return parseSize(value, recorder.slow_iteration_ms);
+    if (key == "busy_poll_us")       return parseSize(value, poll.busy_poll_us);
+    if (key == "cpu_affinity") {
+        if (value == "none") {
+            poll.cpu = -1;
+            return true;
+        }
+        return parseInt(value, poll.cpu);
+    }
+    if (key == "flight_dump_dir") {
+        recorder.dump_dir = value;
+        return !value.empty();
+    }
+    return false;
+}
+
+bool loadConfig(const std::string &path, int default_port, ServerConfig &config, std::string &error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    ServerConfig loaded;
+    std::string raw;
+    int line_number = 0;
+    while (std::getline(file, raw)) {
+        ++line_number;
+        std::string line = trim(raw.substr(0, raw.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        size_t equal = line.find('=');
+        std::string key = trim(line.substr(0, equal));
+        std::string value = (equal == std::string::npos) ? std::string() : trim(line.substr(equal + 1));
+        if (equal == std::string::npos || !applySetting(key, value, default_port, loaded)) {
+            std::ostringstream oss;
+            oss << path << ":" << line_number << ": invalid setting '" << line << "'";
+            error = oss.str();
+            return false;
+        }
+    }
+    config = loaded;
+    return true;
+}
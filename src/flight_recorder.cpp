@@ -0,0 +1,223 @@
+#include "../include/flight_recorder.hpp"
+#include <ctime>
+#include <cctype>
+#include <iomanip>
+
+FlightRecorder::FlightRecorder()
+    : _iterationSeq(0), _eventSeq(0), _origin_ns(now()), _slow_ns(0), _bytesIn(0), _bytesOut(0) {}
+
+long long FlightRecorder::now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+const char *FlightRecorder::typeName(FlightEventType type) {
+    switch (type) {
+        case FLIGHT_ACCEPT:  return "accept";
+        case FLIGHT_READ:    return "read";
+        case FLIGHT_COMMAND: return "command";
+        case FLIGHT_WRITE:   return "write";
+        case FLIGHT_CLOSE:   return "close";
+        default:             return "unknown";
+    }
+}
+
+/**
+ * @brief 記録するループの回数としきい値を設定する。大きさが変わったら記録は捨てて取り直す。
+ */
+void FlightRecorder::configure(size_t iterations, size_t slow_iteration_ms) {
+    _slow_ns = static_cast<long long>(slow_iteration_ms) * 1000000LL;
+    if (iterations == _iterations.size()) {
+        return;
+    }
+    _iterations.assign(iterations, Iteration());
+    _events.assign(iterations * EVENTS_PER_ITERATION, Event());
+    _iterationSeq = 0;
+    _eventSeq = 0;
+}
+
+bool FlightRecorder::enabled() const {
+    return !_iterations.empty();
+}
+
+FlightRecorder::Iteration &FlightRecorder::current() {
+    // beginIteration 前の出来事も番号0の回に入れる
+    unsigned long long seq = (_iterationSeq == 0) ? 0 : _iterationSeq - 1;
+    return _iterations[seq % _iterations.size()];
+}
+
+void FlightRecorder::beginIteration() {
+    if (!enabled()) {
+        return;
+    }
+    Iteration &iteration = _iterations[_iterationSeq % _iterations.size()];
+    iteration.seq = _iterationSeq++;
+    iteration.first_event = _eventSeq;
+    iteration.start_ns = now();
+    iteration.woke_ns = iteration.start_ns;
+    iteration.end_ns = iteration.start_ns;
+    iteration.ready = 0;
+    iteration.bytes_in = 0;
+    iteration.bytes_out = 0;
+}
+
+void FlightRecorder::markWoken(int ready) {
+    if (!enabled()) {
+        return;
+    }
+    Iteration &iteration = current();
+    iteration.woke_ns = now();
+    iteration.end_ns = iteration.woke_ns;
+    iteration.ready = ready;
+}
+
+/**
+ * @brief ループ1回分の記録を閉じる。select から戻ってからの処理時間がしきい値を超えたら true。
+ */
+bool FlightRecorder::endIteration() {
+    if (!enabled()) {
+        return false;
+    }
+    Iteration &iteration = current();
+    iteration.end_ns = now();
+    return _slow_ns > 0 && iteration.end_ns - iteration.woke_ns > _slow_ns;
+}
+
+void FlightRecorder::countBytesIn(size_t bytes) {
+    _bytesIn += bytes;
+    if (enabled()) {
+        current().bytes_in += bytes;
+    }
+}
+
+void FlightRecorder::countBytesOut(size_t bytes) {
+    _bytesOut += bytes;
+    if (enabled()) {
+        current().bytes_out += bytes;
+    }
+}
+
+size_t FlightRecorder::bytesIn() const {
+    return _bytesIn;
+}
+
+size_t FlightRecorder::bytesOut() const {
+    return _bytesOut;
+}
+
+/**
+ * @brief start_ns に始まって今終わった出来事を1つ記録する。label はコマンド行でもよく、先頭の語だけを残す。
+ */
+void FlightRecorder::record(FlightEventType type, int fd, long long start_ns, size_t bytes,
+                            const std::string &label) {
+    if (!enabled()) {
+        return;
+    }
+    Event &event = _events[_eventSeq % _events.size()];
+    event.seq = _eventSeq++;
+    event.start_ns = start_ns;
+    event.duration_ns = now() - start_ns;
+    event.bytes = bytes;
+    event.fd = fd;
+    event.type = type;
+    size_t length = 0;
+    for (; length < label.size() && length + 1 < sizeof(event.label) && label[length] != ' '; ++length) {
+        unsigned char c = label[length];
+        event.label[length] = std::isalnum(c) ? c : '?';
+    }
+    event.label[length] = '\0';
+}
+
+const FlightRecorder::Iteration *FlightRecorder::find(unsigned long long seq) const {
+    if (!enabled() || seq >= _iterationSeq || _iterationSeq - seq > _iterations.size()) {
+        return NULL;
+    }
+    return &_iterations[seq % _iterations.size()];
+}
+
+const FlightRecorder::Event *FlightRecorder::findEvent(unsigned long long seq) const {
+    if (!enabled() || seq >= _eventSeq || _eventSeq - seq > _events.size()) {
+        return NULL;   // まだ記録していないか、すでに上書きされた
+    }
+    return &_events[seq % _events.size()];
+}
+
+unsigned long long FlightRecorder::eventEnd(const Iteration &iteration) const {
+    const Iteration *next = find(iteration.seq + 1);
+    return next ? next->first_event : _eventSeq;
+}
+
+/**
+ * @brief 記録を古い順に文字列で書き出す。時刻は基準からのマイクロ秒。
+ */
+void FlightRecorder::dumpText(std::ostream &out) const {
+    unsigned long long first = (_iterationSeq > _iterations.size()) ? _iterationSeq - _iterations.size() : 0;
+    out << "flight recorder: iterations " << first << ".." << _iterationSeq << std::endl;
+    out << std::fixed << std::setprecision(1);
+    for (unsigned long long seq = first; seq < _iterationSeq; ++seq) {
+        const Iteration *iteration = find(seq);
+        if (iteration == NULL) {
+            continue;
+        }
+        out << "#" << iteration->seq
+            << " t=" << (iteration->start_ns - _origin_ns) / 1000.0
+            << "us wait=" << (iteration->woke_ns - iteration->start_ns) / 1000.0
+            << "us work=" << (iteration->end_ns - iteration->woke_ns) / 1000.0
+            << "us ready=" << iteration->ready
+            << " in=" << iteration->bytes_in << " out=" << iteration->bytes_out << std::endl;
+        for (unsigned long long e = iteration->first_event; e < eventEnd(*iteration); ++e) {
+            const Event *event = findEvent(e);
+            if (event == NULL) {
+                continue;
+            }
+            out << "    " << typeName(event->type) << " fd=" << event->fd;
+            if (event->label[0] != '\0') {
+                out << " " << event->label;
+            }
+            out << " " << event->duration_ns / 1000.0 << "us bytes=" << event->bytes << std::endl;
+        }
+    }
+}
+
+static void traceEvent(std::ostream &out, bool &first, const char *name, const char *category,
+                       long long start_ns, long long duration_ns) {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"" << name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+        << ",\"ts\":" << start_ns / 1000.0 << ",\"dur\":" << duration_ns / 1000.0;
+}
+
+/**
+ * @brief Chrome のトレース形式（Trace Event Format の "X" イベント）で書き出す。
+ *        ループ1回・select の待ち・各出来事がそれぞれ1つの区間になる。
+ */
+void FlightRecorder::exportTrace(std::ostream &out) const {
+    unsigned long long first_seq = (_iterationSeq > _iterations.size()) ? _iterationSeq - _iterations.size() : 0;
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (unsigned long long seq = first_seq; seq < _iterationSeq; ++seq) {
+        const Iteration *iteration = find(seq);
+        if (iteration == NULL) {
+            continue;
+        }
+        traceEvent(out, first, "select", "wait", iteration->start_ns - _origin_ns,
+                   iteration->woke_ns - iteration->start_ns);
+        out << "}";
+        traceEvent(out, first, "iteration", "loop", iteration->woke_ns - _origin_ns,
+                   iteration->end_ns - iteration->woke_ns);
+        out << ",\"args\":{\"seq\":" << iteration->seq << ",\"ready\":" << iteration->ready
+            << ",\"bytes_in\":" << iteration->bytes_in << ",\"bytes_out\":" << iteration->bytes_out << "}}";
+        for (unsigned long long e = iteration->first_event; e < eventEnd(*iteration); ++e) {
+            const Event *event = findEvent(e);
+            if (event == NULL) {
+                continue;
+            }
+            const char *name = (event->label[0] != '\0') ? event->label : typeName(event->type);
+            traceEvent(out, first, name, typeName(event->type), event->start_ns - _origin_ns, event->duration_ns);
+            out << ",\"args\":{\"fd\":" << event->fd << ",\"bytes\":" << event->bytes << "}}";
+        }
+    }
+    out << "\n]}" << std::endl;
+}
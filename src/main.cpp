@@ -4,16 +4,17 @@
 #include <unistd.h>   // sleep関数に必要
 
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <port> <password>\n";
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " <port> <password> [config]\n";
         return 1;
     }
 
     // 引数からポート番号とパスワードを取得
     int port = std::atoi(argv[1]);
     std::string password = argv[2];
+    std::string config_path = (argc == 4) ? argv[3] : "";
 
-    Server server(port, password);
+    Server server(port, password, config_path);
     server.start();
 
     while (true) {
@@ -0,0 +1,66 @@
+#include "../include/memory_budget.hpp"
+
+MemoryBudget::MemoryBudget(size_t limit) : _limit(limit) {
+    for (int i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+        _usage[i] = 0;
+        _peak[i] = 0;
+    }
+}
+
+void MemoryBudget::charge(MemoryCategory category, size_t bytes) {
+    _usage[category] += bytes;
+    if (_usage[category] > _peak[category]) {
+        _peak[category] = _usage[category];
+    }
+}
+
+void MemoryBudget::release(MemoryCategory category, size_t bytes) {
+    // 申告漏れがあっても負にはしない
+    _usage[category] -= (bytes < _usage[category]) ? bytes : _usage[category];
+}
+
+void MemoryBudget::adjust(MemoryCategory category, size_t old_bytes, size_t new_bytes) {
+    if (new_bytes > old_bytes) {
+        charge(category, new_bytes - old_bytes);
+    } else {
+        release(category, old_bytes - new_bytes);
+    }
+}
+
+size_t MemoryBudget::usage(MemoryCategory category) const {
+    return _usage[category];
+}
+
+size_t MemoryBudget::peak(MemoryCategory category) const {
+    return _peak[category];
+}
+
+size_t MemoryBudget::total() const {
+    size_t sum = 0;
+    for (int i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+        sum += _usage[i];
+    }
+    return sum;
+}
+
+size_t MemoryBudget::limit() const {
+    return _limit;
+}
+
+void MemoryBudget::setLimit(size_t limit) {
+    _limit = limit;
+}
+
+bool MemoryBudget::overBudget() const {
+    return _limit != 0 && total() > _limit;
+}
+
+const char *MemoryBudget::categoryName(MemoryCategory category) {
+    switch (category) {
+        case MEM_CONNECTIONS:   return "connections";
+        case MEM_INPUT_BUFFERS: return "input_buffers";
+        case MEM_OUTPUT_QUEUES: return "output_queues";
+        case MEM_CHANNELS:      return "channels";
+        default:                return "unknown";
+    }
+}
@@ -0,0 +1,315 @@
+#include "../include/reply.hpp"
+#include <cstring>
+
+const std::string NO_ARG;
+
+static const size_t INITIAL_OUTPUT_CAPACITY = 512;  // 初めて追記したときに確保する容量
+
+OutputBuffer::OutputBuffer()
+    : _data(), _head(0), _tail(0), _budget(NULL), _category(MEM_OUTPUT_QUEUES) {}
+
+OutputBuffer::OutputBuffer(size_t capacity)
+    : _data(capacity), _head(0), _tail(0), _budget(NULL), _category(MEM_OUTPUT_QUEUES) {}
+
+OutputBuffer::OutputBuffer(const OutputBuffer &other)
+    : _data(other._data), _head(other._head), _tail(other._tail),
+      _budget(NULL), _category(other._category) {}
+
+OutputBuffer &OutputBuffer::operator=(const OutputBuffer &other) {
+    if (this != &other) {
+        if (_budget != NULL) {
+            _budget->adjust(_category, _data.size(), other._data.size());
+        }
+        _data = other._data;
+        _head = other._head;
+        _tail = other._tail;
+    }
+    return *this;
+}
+
+OutputBuffer::~OutputBuffer() {
+    if (_budget != NULL) {
+        _budget->release(_category, _data.size());
+    }
+}
+
+/**
+ * @brief メモリ予算に結び付け、現在の容量を申告する。
+ */
+void OutputBuffer::attachBudget(MemoryBudget *budget, MemoryCategory category) {
+    if (_budget != NULL) {
+        _budget->release(_category, _data.size());
+    }
+    _budget = budget;
+    _category = category;
+    if (_budget != NULL) {
+        _budget->charge(_category, _data.size());
+    }
+}
+
+/**
+ * @brief len バイト追記できるよう領域を空ける。まず送信済み部分を詰め、それでも足りなければ拡張する。
+ */
+void OutputBuffer::makeRoom(size_t len) {
+    if (_tail + len <= _data.size()) {
+        return;
+    }
+    if (_head > 0) {
+        std::memmove(&_data[0], &_data[0] + _head, _tail - _head);
+        _tail -= _head;
+        _head = 0;
+        if (_tail + len <= _data.size()) {
+            return;
+        }
+    }
+    size_t new_size = _data.empty() ? INITIAL_OUTPUT_CAPACITY : _data.size() * 2;
+    while (new_size < _tail + len) {
+        new_size *= 2;
+    }
+    if (_budget != NULL) {
+        _budget->adjust(_category, _data.size(), new_size);
+    }
+    _data.resize(new_size);
+}
+
+void OutputBuffer::append(const char *data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    makeRoom(len);
+    std::memcpy(&_data[0] + _tail, data, len);
+    _tail += len;
+}
+
+void OutputBuffer::append(const std::string &str) {
+    append(str.data(), str.size());
+}
+
+void OutputBuffer::append(const char *str) {
+    append(str, std::strlen(str));
+}
+
+void OutputBuffer::append(char c) {
+    makeRoom(1);
+    _data[_tail++] = c;
+}
+
+void OutputBuffer::appendNumber(long n) {
+    char digits[24];
+    size_t len = 0;
+    bool negative = n < 0;
+    unsigned long value = negative ? -static_cast<unsigned long>(n) : static_cast<unsigned long>(n);
+    do {
+        digits[len++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (negative) {
+        digits[len++] = '-';
+    }
+    makeRoom(len);
+    while (len > 0) {
+        _data[_tail++] = digits[--len];
+    }
+}
+
+const char *OutputBuffer::data() const {
+    return _data.empty() ? NULL : &_data[0] + _head;
+}
+
+size_t OutputBuffer::size() const {
+    return _tail - _head;
+}
+
+bool OutputBuffer::empty() const {
+    return _tail == _head;
+}
+
+size_t OutputBuffer::capacity() const {
+    return _data.size();
+}
+
+void OutputBuffer::consume(size_t len) {
+    _head += len;
+    if (_head >= _tail) {
+        _head = 0;
+        _tail = 0;
+    }
+}
+
+void OutputBuffer::clear() {
+    _head = 0;
+    _tail = 0;
+}
+
+/**
+ * @brief 空になった出力領域の容量を返す。普段の1行ぶん程度（初めの容量）までは持ち続け、
+ *        送るたびに確保し直さないようにする。
+ */
+void OutputBuffer::shrink() {
+    if (!empty() || _data.size() <= INITIAL_OUTPUT_CAPACITY) {
+        return;
+    }
+    if (_budget != NULL) {
+        _budget->release(_category, _data.size());
+    }
+    std::vector<char>().swap(_data);
+    _head = 0;
+    _tail = 0;
+}
+
+/**
+ * @brief 数値リプライの書式テンプレート。%1〜%3は引数、%+Nは引数が空でなければ「空白+引数」、
+ *        %:Nは引数が空でなければ「空白+':'+引数」に展開される。コード順に並べておき、二分探索で引く。
+ */
+struct ReplyTemplate {
+    int code;
+    const char *format;
+};
+
+static const ReplyTemplate REPLY_TEMPLATES[] = {
+    { RPL_WELCOME,          ":Welcome to the Internet Relay Network %1" },
+    { RPL_ENDOFSTATS,       "%1 :End of STATS report" },
+    { RPL_STATSDEBUG,       "%1" },
+    { RPL_ENDOFWHO,         "%1 :End of WHO list" },
+    { RPL_LISTSTART,        "Channel :Users  Name" },
+    { RPL_LIST,             "%1" },
+    { RPL_LISTEND,          ":End of LIST" },
+    { RPL_CHANNELMODEIS,    "%1 %2%+3" },
+    { RPL_NOTOPIC,          "%1 :No topic is set" },
+    { RPL_TOPIC,            "%1 :%2" },
+    { RPL_INVITING,         "%1 %2" },
+    { RPL_WHOREPLY,         "%1" },
+    { RPL_NAMREPLY,         "%1" },
+    { RPL_ENDOFNAMES,       "%1 :End of NAMES list" },
+    { RPL_BANLIST,          "%1 %2%+3" },
+    { RPL_ENDOFBANLIST,     "%1 :End of channel ban list" },
+    { ERR_NOSUCHNICK,       "%1 :No such nick/channel" },
+    { ERR_NOSUCHCHANNEL,    "%1 :No such channel" },
+    { ERR_CANNOTSENDTOCHAN, "%1 :Cannot send to channel" },
+    { ERR_NORECIPIENT,      ":No recipient given (%1)" },
+    { ERR_NOTEXTTOSEND,     ":No text to send" },
+    { ERR_INPUTTOOLONG,     ":Input line was too long" },
+    { ERR_UNKNOWNCOMMAND,   "%1 :Unknown command" },
+    { ERR_NONICKNAMEGIVEN,  ":No nickname given" },
+    { ERR_NICKNAMEINUSE,    "%1 :Nickname is already in use" },
+    { ERR_USERNOTINCHANNEL, "%1 %2 :They aren't on that channel" },
+    { ERR_NOTONCHANNEL,     "%1 :You're not on that channel" },
+    { ERR_NOTREGISTERED,    ":You have not registered" },
+    { ERR_NEEDMOREPARAMS,   "%1 :Not enough parameters" },
+    { ERR_ALREADYREGISTRED, ":Unauthorized command (already registered)" },
+    { ERR_PASSWDMISMATCH,   ":Password incorrect" },
+    { ERR_CHANNELISFULL,    "%1 :Cannot join channel (+l)" },
+    { ERR_UNKNOWNMODE,      "%1 :is unknown mode char to me for %2" },
+    { ERR_INVITEONLYCHAN,   "%1 :Cannot join channel (+i)" },
+    { ERR_BANNEDFROMCHAN,   "%1 :Cannot join channel (+b)" },
+    { ERR_BADCHANNELKEY,    "%1 :Cannot join channel (+k)" },
+    { ERR_CHANOPRIVSNEEDED, "%1 :You're not channel operator" }
+};
+
+/**
+ * @brief 中継メッセージの書式テンプレート。MessageCode の順に並べる。
+ */
+static const char *const MESSAGE_TEMPLATES[] = {
+    "NICK :%1",          // MSG_NICK
+    "JOIN %1",           // MSG_JOIN
+    "PART %1%:2",        // MSG_PART
+    "QUIT :%1",          // MSG_QUIT
+    "PRIVMSG %1 :%2",    // MSG_PRIVMSG
+    "KICK %1 %2 :%3",    // MSG_KICK
+    "INVITE %1 :%2",     // MSG_INVITE
+    "TOPIC %1 :%2",      // MSG_TOPIC
+    "MODE %1 %2%+3"      // MSG_MODE
+};
+
+// 表の行数が列挙の数と食い違っていればコンパイルエラーにする（C++98 には static_assert がない）
+typedef char ReplyTemplatesMatchEnum[
+    (sizeof(REPLY_TEMPLATES) / sizeof(REPLY_TEMPLATES[0]) == REPLY_CODE_COUNT) ? 1 : -1];
+typedef char MessageTemplatesMatchEnum[
+    (sizeof(MESSAGE_TEMPLATES) / sizeof(MESSAGE_TEMPLATES[0]) == MSG_CODE_COUNT) ? 1 : -1];
+
+/**
+ * @brief コードに対応するテンプレートを二分探索で引く。表にないコードは空のテンプレートにする。
+ */
+static const char *findReplyTemplate(int code) {
+    size_t low = 0;
+    size_t high = sizeof(REPLY_TEMPLATES) / sizeof(REPLY_TEMPLATES[0]);
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (REPLY_TEMPLATES[mid].code < code) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < sizeof(REPLY_TEMPLATES) / sizeof(REPLY_TEMPLATES[0]) && REPLY_TEMPLATES[low].code == code) {
+        return REPLY_TEMPLATES[low].format;
+    }
+    return "";
+}
+
+/**
+ * @brief テンプレートを展開しながら出力領域に書き込み、末尾に CRLF を付ける。
+ */
+static void expandTemplate(OutputBuffer &out, const char *format, const std::string &arg1,
+                           const std::string &arg2, const std::string &arg3) {
+    const std::string *args[3] = { &arg1, &arg2, &arg3 };
+    const char *literal = format;
+    const char *p = format;
+    while (*p != '\0') {
+        if (*p != '%') {
+            ++p;
+            continue;
+        }
+        out.append(literal, p - literal);
+        bool optional = (p[1] == '+' || p[1] == ':');
+        const std::string &arg = *args[p[optional ? 2 : 1] - '1'];
+        if (!optional) {
+            out.append(arg);
+        } else if (!arg.empty()) {
+            out.append(' ');
+            if (p[1] == ':') {
+                out.append(':');
+            }
+            out.append(arg);
+        }
+        p += optional ? 3 : 2;
+        literal = p;
+    }
+    out.append(literal, p - literal);
+    out.append("\r\n", 2);
+}
+
+void formatReply(OutputBuffer &out, ReplyCode code, const std::string &target,
+                 const std::string &arg1, const std::string &arg2, const std::string &arg3) {
+    out.append(':');
+    out.append(SERVER_NAME);
+    out.append(' ');
+    // 数値リプライは常に3桁
+    out.append(static_cast<char>('0' + code / 100));
+    out.append(static_cast<char>('0' + code / 10 % 10));
+    out.append(static_cast<char>('0' + code % 10));
+    out.append(' ');
+    if (target.empty()) {
+        out.append('*');
+    } else {
+        out.append(target);
+    }
+    out.append(' ');
+    expandTemplate(out, findReplyTemplate(code), arg1, arg2, arg3);
+}
+
+void formatMessage(OutputBuffer &out, const MessageSource &source, MessageCode code,
+                   const std::string &arg1, const std::string &arg2, const std::string &arg3) {
+    out.append(':');
+    out.append(source.nick);
+    if (!source.user.empty()) {
+        out.append('!');
+        out.append(source.user);
+    }
+    if (!source.host.empty()) {
+        out.append('@');
+        out.append(source.host);
+    }
+    out.append(' ');
+    expandTemplate(out, MESSAGE_TEMPLATES[code], arg1, arg2, arg3);
+}
@@ -10,24 +10,49 @@
 #include <sstream>
 #include <algorithm>
 #include <fcntl.h>  // fcntlでのO_NONBLOCK設定に使用
+#include <csignal>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 /**
- * @brief コンストラクタ。サーバーポートとパスワードを設定し、ソケットFDの初期値を-1にする。
+ * @brief コンストラクタ。サーバーポートとパスワード、設定ファイルのパス（空なら既定値で動く）を設定する。
  */
-Server::Server(int port, const std::string &password)
-    : _port(port), _password(password), _server_fd(-1) {
+Server::Server(int port, const std::string &password, const std::string &config_path)
+    : _port(port), _password(password), _config_path(config_path), _transport(&_socketTransport),
+      _recvBuffer(_limits.recv_buffer_size), _broadcastBuffer(512), _flightDumps(0), _lastSlowDump(0),
+      _pinnedCpu(-1) {
+    _memory.setLimit(_limits.memory_budget);
+    _recorder.configure(_config.recorder.iterations, _config.recorder.slow_iteration_ms);
+}
+
+/**
+ * @brief 待ち受けソケットを持たないサーバーを作る。接続は attachConnection で登録し、
+ *        読み書きはすべて transport に任せる（start は呼ばない）。
+ */
+Server::Server(const std::string &password, Transport &transport)
+    : _port(0), _password(password), _transport(&transport),
+      _recvBuffer(_limits.recv_buffer_size), _broadcastBuffer(512), _flightDumps(0), _lastSlowDump(0),
+      _pinnedCpu(-1) {
+    _memory.setLimit(_limits.memory_budget);
+    _recorder.configure(_config.recorder.iterations, _config.recorder.slow_iteration_ms);
 }
 
 /**
  * @brief デストラクタ。サーバーソケットを正しくクローズし、すべてのクライアントを削除する。
  */
 Server::~Server() {
-    if (_server_fd != -1) {
-        close(_server_fd);
+    for (size_t i = 0; i < _listeners.size(); ++i) {
+        closeListener(_listeners[i]);
     }
     // 念のためクライアントをすべてクローズ
     for (size_t i = 0; i < _client_fds.size(); ++i) {
-        close(_client_fds[i]);
+        _transport->disconnect(_client_fds[i]);
     }
     _client_fds.clear();
     _clients.clear();
@@ -45,617 +70,1426 @@ static bool setNonBlocking(int fd) {
 }
 
 /**
- * @brief サーバーを起動し、クライアントからの接続を受け入れるメインループを実行。
- *        非ブロッキングソケットを用い、selectを1か所のみ使用して管理する。
+ * @brief イベントループを cpu 番の CPU に固定する。固定していない状態から固定するときは
+ *        その時点の割り当てを覚えておき、cpu が -1 ならそれに戻す。成功したら true。
  */
-void Server::start() {
-    // ソケット作成
-    _server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (_server_fd < 0) {
-        std::cerr << "Socket creation failed: " << strerror(errno) << std::endl;
-        return;
+static bool pinEventLoop(int cpu, bool pinned) {
+#ifdef __linux__
+    static cpu_set_t original;
+    if (cpu >= 0 && !pinned && sched_getaffinity(0, sizeof(original), &original) == -1) {
+        std::cerr << "sched_getaffinity failed: " << strerror(errno) << std::endl;
+        return false;
     }
-    // ノンブロッキングに設定
-    if (!setNonBlocking(_server_fd)) {
-        std::cerr << "Failed to set server socket to non-blocking." << std::endl;
-        close(_server_fd);
-        _server_fd = -1;
-        return;
+    cpu_set_t set;
+    if (cpu < 0) {
+        set = original;
+    } else {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
     }
-
-    // アドレス再利用設定（アプリ終了直後などにすぐ使いやすくするため）
-    int opt = 1;
-    if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        std::cerr << "setsockopt failed: " << strerror(errno) << std::endl;
-        close(_server_fd);
-        _server_fd = -1;
-        return;
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        std::cerr << "Cannot pin event loop to CPU " << cpu << ": " << strerror(errno) << std::endl;
+        return false;
     }
-
-    // サーバーのアドレス情報を設定
-    sockaddr_in address;
-    std::memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(_port);
-
-    // ソケットにアドレスをバインド
-    if (bind(_server_fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
-        std::cerr << "Bind failed: " << strerror(errno) << std::endl;
-        close(_server_fd);
-        _server_fd = -1;
-        return;
+    if (cpu >= 0) {
+        std::cout << "Event loop pinned to CPU " << cpu << std::endl;
+    } else {
+        std::cout << "Event loop unpinned" << std::endl;
     }
-
-    // ソケットをリスニング状態に設定
-    if (listen(_server_fd, 10) == -1) {
-        std::cerr << "Listen failed: " << strerror(errno) << std::endl;
-        close(_server_fd);
-        _server_fd = -1;
-        return;
+    return true;
+#else
+    (void)pinned;
+    if (cpu >= 0) {
+        std::cerr << "CPU pinning is not supported on this platform" << std::endl;
     }
+    return cpu < 0;
+#endif
+}
 
-    std::cout << "Server started on port " << _port << std::endl;
+/**
+ * @brief SIGHUP を受けたら立てるフラグ。メインループで設定ファイルを読み直す。
+ */
+static volatile sig_atomic_t g_reloadRequested = 0;
 
-    // メインループ：selectを用いてクライアントFDとサーバーFDを同時に監視
-    while (true) {
-        // fd_setを毎ループ初期化
-        FD_ZERO(&_read_fds);
-        FD_SET(_server_fd, &_read_fds);
-        int max_fd = _server_fd;
+static void handleSighup(int) {
+    g_reloadRequested = 1;
+}
 
-        // クライアントFDの追加
-        for (size_t i = 0; i < _client_fds.size(); ++i) {
-            int fd = _client_fds[i];
-            FD_SET(fd, &_read_fds);
-            if (fd > max_fd) {
-                max_fd = fd;
-            }
-        }
+/**
+ * @brief SIGUSR1 を受けたら立てるフラグ。メインループでフライトレコーダーの記録を書き出す。
+ */
+static volatile sig_atomic_t g_dumpRequested = 0;
 
-        // selectで監視
-        int activity = select(max_fd + 1, &_read_fds, NULL, NULL, NULL);
-        if (activity < 0 && errno != EINTR) {
-            std::cerr << "Select error: " << strerror(errno) << std::endl;
-        }
+static void handleSigusr1(int) {
+    g_dumpRequested = 1;
+}
 
-        // 新規接続
-        if (FD_ISSET(_server_fd, &_read_fds)) {
-            acceptClient();
-        }
+/**
+ * @brief setsockopt の失敗はログに残すだけにして、接続そのものは続ける。
+ */
+static void setIntOption(int fd, int level, int name, int value, const char *label) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) == -1) {
+        std::cerr << "setsockopt " << label << " failed on fd " << fd << ": " << strerror(errno) << std::endl;
+    }
+}
 
-        // 各クライアントのハンドリング
-        for (size_t i = 0; i < _client_fds.size(); ++i) {
-            int fd = _client_fds[i];
-            if (FD_ISSET(fd, &_read_fds)) {
-                handleClient(fd);
-            }
-        }
+/**
+ * @brief 送受信バッファの大きさを設定する（0ならカーネルの既定値のまま）。
+ */
+static void applyBufferOptions(int fd, const SocketOptions &options) {
+    if (options.send_buffer > 0) {
+        setIntOption(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF");
+    }
+    if (options.recv_buffer > 0) {
+        setIntOption(fd, SOL_SOCKET, SO_RCVBUF, options.recv_buffer, "SO_RCVBUF");
     }
 }
 
 /**
- * @brief 新しいクライアント接続を受け入れる。accept後、認証処理を行い、
- *        認証成功したらクライアントリストに追加し、対応バッファを初期化する。
+ * @brief 待ち受けソケットのオプションを設定する。受け付けたソケットはバッファの設定を引き継ぐ。
  */
-void Server::acceptClient() {
-    sockaddr_in client_address;
-    socklen_t client_address_len = sizeof(client_address);
-    int client_fd = accept(_server_fd, (struct sockaddr*)&client_address, &client_address_len);
-    if (client_fd < 0) {
-        if (errno != EWOULDBLOCK && errno != EAGAIN) {
-            std::cerr << "Accept failed: " << strerror(errno) << std::endl;
-        }
+static void applyListenerOptions(int fd, const SocketOptions &options, int family) {
+    applyBufferOptions(fd, options);
+    if (family == AF_UNIX) {
         return;
     }
+#ifdef TCP_DEFER_ACCEPT
+    // データが届くまで accept を遅らせ、接続直後の空振りの読み取りを減らす
+    setIntOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept, "TCP_DEFER_ACCEPT");
+#endif
+}
 
-    // クライアントソケットをノンブロッキングに
-    if (!setNonBlocking(client_fd)) {
-        std::cerr << "Failed to set client socket to non-blocking. Closing." << std::endl;
-        close(client_fd);
+/**
+ * @brief クライアントソケットのオプションを設定する。設定の読み直し時には接続済みのソケットにもかけ直す。
+ *        AF_UNIX の接続には TCP のオプションをかけない。
+ */
+static void applyClientOptions(int fd, const SocketOptions &options, int family) {
+    applyBufferOptions(fd, options);
+    if (family == AF_UNIX) {
         return;
     }
-
-    // クライアント追加（認証前の初期状態）
-    _client_fds.push_back(client_fd);
-    _clients[client_fd] = ClientInfo(); // デフォルトコンストラクタでauthenticated=false, password_sent=falseに
-    _clientBuffers[client_fd] = std::string();
-    
-    std::cout << "New client connected: " << client_fd << std::endl;
-    
-    // パスワードプロンプトを送信
-    const std::string password_prompt = "Enter server password: ";
-    send(client_fd, password_prompt.c_str(), password_prompt.size(), 0);
-    _clients[client_fd].password_sent = true;
+    setIntOption(fd, IPPROTO_TCP, TCP_NODELAY, options.tcp_nodelay ? 1 : 0, "TCP_NODELAY");
+#ifdef SO_BUSY_POLL
+    if (options.busy_poll > 0) {
+        setIntOption(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll, "SO_BUSY_POLL");
+    }
+#endif
+    setIntOption(fd, SOL_SOCKET, SO_KEEPALIVE, options.keepalive ? 1 : 0, "SO_KEEPALIVE");
+    if (!options.keepalive) {
+        return;
+    }
+#ifdef TCP_KEEPIDLE
+    if (options.keepalive_idle > 0) {
+        setIntOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, options.keepalive_idle, "TCP_KEEPIDLE");
+    }
+#endif
+#ifdef TCP_KEEPINTVL
+    if (options.keepalive_interval > 0) {
+        setIntOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, options.keepalive_interval, "TCP_KEEPINTVL");
+    }
+#endif
+#ifdef TCP_KEEPCNT
+    if (options.keepalive_count > 0) {
+        setIntOption(fd, IPPROTO_TCP, TCP_KEEPCNT, options.keepalive_count, "TCP_KEEPCNT");
+    }
+#endif
 }
 
-
 /**
- * @brief クライアントの認証を行う。パスワードを送受信して接続パスワードと比較。
+ * @brief 指定アドレスで待ち受けるソケットを開き、_listeners に加える。
+ *        IPv4・IPv6・AF_UNIX のどれも同じ select ループで扱う。
  */
-bool Server::authenticateClient(int client_fd) {
-    char buffer[1024];
-    std::memset(buffer, 0, sizeof(buffer));
-    int valread = recv(client_fd, buffer, sizeof(buffer), 0);
-
-    if (valread < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // まだデータが届いていない、次のselectで再試行
-            return true; // 接続は維持
-        } else {
-            std::cerr << "Failed to read password from client: " << strerror(errno) << std::endl;
+bool Server::openListener(const ListenAddress &listen_address) {
+    // サーバーのアドレス情報を設定
+    sockaddr_storage address;
+    socklen_t address_len = 0;
+    std::memset(&address, 0, sizeof(address));
+    int family;
+    if (listen_address.isUnix()) {
+        sockaddr_un *un = reinterpret_cast<sockaddr_un*>(&address);
+        if (listen_address.path.size() >= sizeof(un->sun_path)) {
+            std::cerr << "Unix socket path too long: " << listen_address.path << std::endl;
+            return false;
+        }
+        family = AF_UNIX;
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, listen_address.path.c_str(), listen_address.path.size() + 1);
+        address_len = sizeof(sockaddr_un);
+    } else if (listen_address.host.find(':') != std::string::npos) {
+        sockaddr_in6 *in6 = reinterpret_cast<sockaddr_in6*>(&address);
+        family = AF_INET6;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(listen_address.port);
+        if (inet_pton(AF_INET6, listen_address.host.c_str(), &in6->sin6_addr) != 1) {
+            std::cerr << "Invalid bind address: " << listen_address.host << std::endl;
+            return false;
+        }
+        address_len = sizeof(sockaddr_in6);
+    } else {
+        sockaddr_in *in = reinterpret_cast<sockaddr_in*>(&address);
+        family = AF_INET;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(listen_address.port);
+        if (listen_address.host == "*") {
+            in->sin_addr.s_addr = INADDR_ANY;
+        } else if (inet_pton(AF_INET, listen_address.host.c_str(), &in->sin_addr) != 1) {
+            std::cerr << "Invalid bind address: " << listen_address.host << std::endl;
             return false;
         }
+        address_len = sizeof(sockaddr_in);
     }
-    
-    if (valread == 0) {
-        // クライアント切断
-        std::cerr << "Client disconnected before sending password." << std::endl;
+
+    // ソケット作成
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Socket creation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    // ノンブロッキングに設定
+    if (!setNonBlocking(fd)) {
+        std::cerr << "Failed to set server socket to non-blocking." << std::endl;
+        close(fd);
         return false;
     }
 
-    std::string received_password(buffer, valread);
-    size_t trim_pos = received_password.find_last_not_of(" \n\r\t");
-    if (trim_pos != std::string::npos) {
-        received_password.erase(trim_pos + 1);
+    if (family == AF_UNIX) {
+        // 前回の起動で残ったソケットファイルだけを消す（通常のファイルは消さない）。
+        // 動いているサーバーのソケットを消さないよう、つないでみて誰も待っていないときだけ消す
+        struct stat st;
+        if (stat(listen_address.path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (probe < 0) {
+                std::cerr << "Socket creation failed: " << strerror(errno) << std::endl;
+                close(fd);
+                return false;
+            }
+            int result = connect(probe, reinterpret_cast<struct sockaddr*>(&address), address_len);
+            int probe_errno = errno;
+            close(probe);
+            if (result == 0) {
+                std::cerr << "Another server is listening on " << listen_address.describe() << std::endl;
+                close(fd);
+                return false;
+            }
+            if (probe_errno == ECONNREFUSED) {
+                unlink(listen_address.path.c_str());
+            }
+        }
+    } else {
+        // アドレス再利用設定（アプリ終了直後などにすぐ使いやすくするため）
+        int opt = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+            std::cerr << "setsockopt failed: " << strerror(errno) << std::endl;
+            close(fd);
+            return false;
+        }
+        // IPv6 の待ち受けは IPv6 だけにし、同じポートの IPv4 の待ち受けと共存させる
+        if (family == AF_INET6) {
+            setIntOption(fd, IPPROTO_IPV6, IPV6_V6ONLY, 1, "IPV6_V6ONLY");
+        }
+    }
+    applyListenerOptions(fd, _config.socket, family);
+
+    // ソケットにアドレスをバインド
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), address_len) == -1) {
+        std::cerr << "Bind failed for " << listen_address.describe() << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
     }
 
-    if (received_password != _password) {
-        const std::string error_message = "Incorrect password. Connection closed.\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    // ソケットをリスニング状態に設定
+    if (listen(fd, _config.socket.backlog) == -1) {
+        std::cerr << "Listen failed: " << strerror(errno) << std::endl;
+        close(fd);
+        if (family == AF_UNIX) {
+            unlink(listen_address.path.c_str());
+        }
         return false;
     }
 
-    const std::string success_message = "Password accepted. Welcome!\n";
-    send(client_fd, success_message.c_str(), success_message.size(), 0);
-    _clients[client_fd].authenticated = true; // 認証成功
+    Listener listener;
+    listener.fd = fd;
+    listener.family = family;
+    listener.address = listen_address;
+    _listeners.push_back(listener);
+    std::cout << "Listening on " << listen_address.describe() << std::endl;
     return true;
 }
 
-
 /**
- * @brief クライアントからのデータを読み取り、\n区切りでコマンドに分割。各コマンドを処理する。
+ * @brief 待ち受けソケットを閉じる。AF_UNIX ならソケットファイルも消す。
  */
-void Server::handleClient(int client_fd) {
-    // 認証されていない場合、まず認証を試みる
-    if (!_clients[client_fd].authenticated) {
-        if (!authenticateClient(client_fd)) {
-            removeClient(client_fd);
-            return;
-        }
-        
-        // まだ認証できていない場合は次のselectまで待機
-        if (!_clients[client_fd].authenticated) {
-            return;
-        }
+void Server::closeListener(const Listener &listener) {
+    close(listener.fd);
+    if (listener.address.isUnix()) {
+        unlink(listener.address.path.c_str());
     }
-    
-    // 認証済みクライアントの通常の処理
-    // 一時的に受信バッファに読み込み
-    char tempBuf[1024];
-    std::memset(tempBuf, 0, sizeof(tempBuf));
-    int valread = recv(client_fd, tempBuf, sizeof(tempBuf), 0);
-    
-    if (valread < 0) {
-        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            return; // エラーメッセージ表示なし
-        }
-        // その他の実際のエラーの場合
-        removeClient(client_fd);
-        return;
+}
+
+/**
+ * @brief 設定を反映する。待ち受けアドレスの増減に合わせてソケットを開閉し、
+ *        残したソケットと接続済みのクライアントにはオプションをかけ直す。既存の接続は切らない。
+ */
+void Server::applyConfig(const ServerConfig &config) {
+    _config = config;
+    if (_config.binds.empty()) {
+        _config.binds.push_back(ListenAddress("0.0.0.0", _port));
     }
-    else if (valread == 0) {
-        removeClient(client_fd);
-        return;
+    _limits = _config.limits;
+    _memory.setLimit(_limits.memory_budget);
+    _recvBuffer.resize(_limits.recv_buffer_size);
+    _recorder.configure(_config.recorder.iterations, _config.recorder.slow_iteration_ms);
+    // 設定が変わったときだけ触る（固定していなければ、運用側で変えた割り当てをそのままにする）
+    if (_config.poll.cpu != _pinnedCpu && pinEventLoop(_config.poll.cpu, _pinnedCpu >= 0)) {
+        _pinnedCpu = _config.poll.cpu;
     }
 
-    std::string &bufRef = _clientBuffers[client_fd];
-    bufRef.append(tempBuf, valread);
-
-    // 改行(\n)単位でコマンドを切り出す
-    size_t pos;
-    while ((pos = bufRef.find('\n')) != std::string::npos) {
-        // 1行分のコマンド
-        std::string line = bufRef.substr(0, pos);
-        bufRef.erase(0, pos + 1);
-
-        if (line.empty()) {
-            continue;
-        }
-        // コマンド文字列を解析
-        std::istringstream iss(line);
-        std::string command;
-        iss >> command;
-
-        if (command == "NICK") {
-            std::string nickname;
-            iss >> nickname;
-            handleNickCommand(client_fd, nickname);
-        } else if (command == "USER") {
-            std::string username;
-            iss >> username;
-            handleUserCommand(client_fd, username);
-        } else if (command == "JOIN") {
-            std::string channel_name;
-            std::string password;
-            iss >> channel_name >> password;
-            handleJoinCommand(client_fd, channel_name, password);
-        } else if (command == "PRIVMSG") {
-            std::string target;
-            iss >> target;
-            // メッセージの残りをすべて取得
-            std::string message;
-            std::getline(iss, message);
-            if (!message.empty() && message[0] == ' ') {
-                message.erase(0, 1);
-            }
-            handlePrivmsgCommand(client_fd, target, message);
-        } else if (command == "KICK") {
-            std::string channel_name, target_nickname;
-            iss >> channel_name >> target_nickname;
-            handleKickCommand(client_fd, channel_name, target_nickname);
-        } else if (command == "MODE") {
-            std::string channel_name, mode, parameter;
-            iss >> channel_name >> mode >> parameter;
-            handleModeCommand(client_fd, channel_name, mode, parameter);
-        } else if (command == "INVITE") {
-            std::string target_nickname, channel_name;
-            iss >> target_nickname >> channel_name;
-            handleInviteCommand(client_fd, target_nickname, channel_name);
-        } else if (command == "TOPIC") {
-            // トピックを変更または取得
-            std::string channel_name;
-            iss >> channel_name; 
-            std::string new_topic;
-            std::getline(iss, new_topic);
-            if (!new_topic.empty() && new_topic[0] == ' ') {
-                new_topic.erase(0, 1);
-            }
-            handleTopicCommand(client_fd, channel_name, new_topic);
+    // 設定から消えた待ち受けを閉じる
+    for (size_t i = 0; i < _listeners.size(); ) {
+        if (std::find(_config.binds.begin(), _config.binds.end(), _listeners[i].address) == _config.binds.end()) {
+            std::cout << "Closing listener " << _listeners[i].address.describe() << std::endl;
+            closeListener(_listeners[i]);
+            _listeners.erase(_listeners.begin() + i);
         } else {
-            const std::string error_message = "Unknown command.\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
+            ++i;
+        }
+    }
+    // 残った待ち受けはオプションと backlog をかけ直し、新しいアドレスは開く
+    for (size_t i = 0; i < _config.binds.size(); ++i) {
+        bool found = false;
+        for (size_t j = 0; j < _listeners.size(); ++j) {
+            if (_listeners[j].address == _config.binds[i]) {
+                applyListenerOptions(_listeners[j].fd, _config.socket, _listeners[j].family);
+                // 失敗しても待ち受けは前の backlog のまま続くので、閉じずに知らせるだけにする
+                if (listen(_listeners[j].fd, _config.socket.backlog) == -1) {
+                    std::cerr << "Listen failed for " << _listeners[j].address.describe() << ": "
+                              << strerror(errno) << std::endl;
+                }
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            openListener(_config.binds[i]);
+        }
+    }
+    for (size_t i = 0; i < _client_fds.size(); ++i) {
+        sockaddr_storage local;
+        socklen_t local_len = sizeof(local);
+        if (getsockname(_client_fds[i], reinterpret_cast<struct sockaddr*>(&local), &local_len) == 0) {
+            applyClientOptions(_client_fds[i], _config.socket, local.ss_family);
         }
     }
 }
 
 /**
- * @brief クライアントのニックネームを設定。
- */
-void Server::handleNickCommand(int client_fd, const std::string &nickname) {
-    _clients[client_fd].nickname = nickname;
-    std::string response = "Nickname set to " + nickname + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
-}
-
-/**
- * @brief クライアントのユーザー名を設定する。
+ * @brief 設定ファイルを読み直す。読み込みに失敗したら今の設定のまま動き続ける。
  */
-void Server::handleUserCommand(int client_fd, const std::string &username) {
-    _clients[client_fd].username = username;
-    std::string response = "Username set to " + username + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
+void Server::reloadConfig() {
+    if (_config_path.empty()) {
+        return;
+    }
+    ServerConfig config;
+    std::string error;
+    if (!loadConfig(_config_path, _port, config, error)) {
+        std::cerr << "Config reload failed, keeping current settings: " << error << std::endl;
+        return;
+    }
+    applyConfig(config);
+    std::cout << "Configuration reloaded from " << _config_path << std::endl;
 }
 
 /**
- * @brief クライアントをチャネルに参加させるコマンドJOINの処理。
+ * @brief サーバーを起動し、クライアントからの接続を受け入れるメインループを実行。
+ *        非ブロッキングソケットを用い、selectを1か所のみ使用して管理する。
  */
-void Server::handleJoinCommand(int client_fd, const std::string &channel_name, const std::string &password) {
-    // std::cout << "DEBUG JOIN: channel=" << channel_name << " password='" << password << "'" << std::endl;
-    
-    if (_channels.find(channel_name) == _channels.end()) {
-        createChannel(channel_name, client_fd);
-    } else {
-        // +iモードのチェック - 既存
-        if (_channels[channel_name].hasMode('i') && 
-            !_channels[channel_name].isInvitee(client_fd)) {
-            std::string error_message = "Cannot join channel (+i)\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
+void Server::start() {
+    ServerConfig config;
+    if (!_config_path.empty()) {
+        std::string error;
+        if (!loadConfig(_config_path, _port, config, error)) {
+            std::cerr << "Config error: " << error << std::endl;
             return;
         }
-        
-        // +kモードのチェック - 既存
-        if (_channels[channel_name].hasMode('k') && 
-            !_channels[channel_name].checkPassword(password)) {
-            std::string error_message = "Cannot join channel (wrong password)\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
-            return;
+    }
+    applyConfig(config);
+    if (_listeners.empty()) {
+        std::cerr << "No listening socket could be opened." << std::endl;
+        return;
+    }
+
+    std::cout << "Server started on port " << _port << std::endl;
+
+    // 切断済みのソケットへの送信でプロセスが落ちないようにする
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGHUP で設定ファイルを読み直す（select を EINTR で抜けさせるため SA_RESTART は付けない）
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSighup;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+    // SIGUSR1 でフライトレコーダーの記録を書き出す
+    action.sa_handler = handleSigusr1;
+    sigaction(SIGUSR1, &action, NULL);
+
+    // busy_poll_us が設定されていれば、待ち始めからその時間はタイムアウト0の select で回り続ける。
+    // 0 のときは spin_until が待ち始めの時刻になり、最初から眠って待つ
+    long long spin_until = 0;
+
+    // メインループ：selectを用いてクライアントFDとサーバーFDを同時に監視
+    while (true) {
+        if (g_reloadRequested) {
+            g_reloadRequested = 0;
+            reloadConfig();
         }
-        
-        // +lモードのチェック - 追加
-        if (_channels[channel_name].hasMode('l') && 
-            _channels[channel_name].isUserLimitReached()) {
-            std::string error_message = "Cannot join channel (+l): user limit reached\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
-            return;
+        if (g_dumpRequested) {
+            g_dumpRequested = 0;
+            dumpFlightRecorder("SIGUSR1");
         }
-    }
-    joinChannel(client_fd, channel_name);
-}
 
-/**
- * @brief PRIVMSGコマンドの処理。ターゲットがチャネルかユーザーで分岐。
- */
-void Server::handlePrivmsgCommand(int client_fd,
-                            const std::string &target,
-                            const std::string &message) {
-    if (_channels.find(target) != _channels.end()) {
-        // チャネルに送信
-        const std::vector<int>& clients = _channels[target].getClients();
+        // fd_setを毎ループ初期化
+        FD_ZERO(&_read_fds);
+        FD_ZERO(&_write_fds);
+        int max_fd = -1;
+        for (size_t i = 0; i < _listeners.size(); ++i) {
+            FD_SET(_listeners[i].fd, &_read_fds);
+            if (_listeners[i].fd > max_fd) {
+                max_fd = _listeners[i].fd;
+            }
+        }
 
-        // チャンネルのメンバーでない場合
-        if (std::find(clients.begin(), clients.end(), client_fd) == clients.end()) {
-            std::string error_message = "You are not in channel: " + target + "\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
-            return;
+        // クライアントFDの追加（送信待ちがあるものは書き込みも監視）
+        // メモリ予算を超えている間は、送信待ちを抱えた接続からの読み取りを止める
+        bool over_budget = _memory.overBudget();
+        for (size_t i = 0; i < _client_fds.size(); ++i) {
+            int fd = _client_fds[i];
+            bool pending = hasPendingOutput(fd);
+            if (!_clients[fd].quitting && !(over_budget && pending)) {
+                FD_SET(fd, &_read_fds);
+            }
+            if (pending) {
+                FD_SET(fd, &_write_fds);
+            }
+            if (fd > max_fd) {
+                max_fd = fd;
+            }
         }
 
-        if (_channels[target].hasMode('m') &&
-            !_channels[target].isOperator(client_fd)) {
-            std::string error_message = "Channel is moderated. Only operators can send messages.\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
-            return;
+        // selectで監視（回っている間の空振りは1回の待ちとして記録する）
+        if (spin_until == 0) {
+            _recorder.beginIteration();
+            spin_until = FlightRecorder::now() + static_cast<long long>(_config.poll.busy_poll_us) * 1000;
         }
-        // 同じチャネルの他のクライアントにメッセージを転送
-        for (size_t i = 0; i < clients.size(); ++i) {
-            if (clients[i] != client_fd) {
-                std::string full_message = _clients[client_fd].nickname + ": " + message + "\n";
-                send(clients[i], full_message.c_str(), full_message.size(), 0);
+        timeval no_wait = { 0, 0 };
+        timeval *timeout = (FlightRecorder::now() < spin_until) ? &no_wait : NULL;
+        int activity = select(max_fd + 1, &_read_fds, &_write_fds, NULL, timeout);
+        if (activity == 0 && timeout != NULL) {
+            continue;
+        }
+        spin_until = 0;
+        _recorder.markWoken(activity);
+        if (activity < 0) {
+            if (errno != EINTR) {
+                std::cerr << "Select error: " << strerror(errno) << std::endl;
             }
+            continue;
         }
-    } else {
-        // 個人に送信
-        int target_fd = -1;
-        for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-            if (it->second.nickname == target) {
-                target_fd = it->first;
-                break;
+
+        // 新規接続
+        for (size_t i = 0; i < _listeners.size(); ++i) {
+            if (FD_ISSET(_listeners[i].fd, &_read_fds)) {
+                acceptClient(_listeners[i]);
             }
         }
-        if (target_fd == -1) {
-            std::string error_message = "No such user or channel: " + target + "\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
-            return;
+
+        // 各クライアントのハンドリング
+        // 処理中に切断されるクライアントがいても走査がずれないよう、FD一覧を複製してから回す
+        std::vector<int> ready_fds(_client_fds);
+        for (size_t i = 0; i < ready_fds.size(); ++i) {
+            if (FD_ISSET(ready_fds[i], &_read_fds)) {
+                onReadable(ready_fds[i]);
+            }
+        }
+        for (size_t i = 0; i < ready_fds.size(); ++i) {
+            if (FD_ISSET(ready_fds[i], &_write_fds)) {
+                onWritable(ready_fds[i]);
+            }
+        }
+        finishIteration();
+        if (_recorder.endIteration()) {
+            dumpSlowIteration();
         }
-        std::string full_message = _clients[client_fd].nickname + ": " + message + "\n";
-        send(target_fd, full_message.c_str(), full_message.size(), 0);
     }
 }
 
 /**
- * @brief INVITEコマンドの処理。指定ユーザーをチャネルに招待する。
+ * @brief data を新しいファイルとして書き出す（所有者だけが読める）。
+ *        書き出し先は /tmp のような共有ディレクトリでもよいように、既にあるファイルやシンボリックリンクは開かない。
  */
-void Server::handleInviteCommand(int client_fd,
-                                 const std::string &target_nickname,
-                                 const std::string &channel_name) {
-    if (_channels.find(channel_name) == _channels.end()) {
-        std::string error_message = "No such channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
-        return;
+static bool writeNewFile(const std::string &path, const std::string &data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        return false;
     }
-    if (!_channels[channel_name].isOperator(client_fd)) {
-        std::string error_message = "You are not an operator of channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
-        return;
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            int saved_errno = (n < 0) ? errno : EIO;
+            close(fd);
+            unlink(path.c_str());
+            errno = saved_errno;
+            return false;
+        }
+        written += n;
     }
+    return close(fd) == 0;
+}
 
-    int target_fd = -1;
-    for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second.nickname == target_nickname) {
-            target_fd = it->first;
-            break;
-        }
+/**
+ * @brief フライトレコーダーの記録を、文字列の一覧と Chrome のトレース形式の2つのファイルに書き出す。
+ */
+void Server::dumpFlightRecorder(const std::string &reason) {
+    if (!_recorder.enabled()) {
+        std::cerr << "Flight recorder is disabled (" << reason << ")" << std::endl;
+        return;
     }
-    if (target_fd == -1) {
-        std::string error_message = "No such user or channel: " + target_nickname + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    std::ostringstream base;
+    base << _config.recorder.dump_dir << "/ircserv-flight-" << getpid() << "-" << ++_flightDumps;
+    std::string text_path = base.str() + ".txt";
+    std::string trace_path = base.str() + ".json";
+    std::ostringstream text;
+    std::ostringstream trace;
+    text << "reason: " << reason << std::endl;
+    _recorder.dumpText(text);
+    _recorder.exportTrace(trace);
+    if (!writeNewFile(text_path, text.str())) {
+        std::cerr << "Flight recorder dump failed: cannot create " << text_path << ": " << strerror(errno) << std::endl;
         return;
     }
-
-    _channels[channel_name].addInvitee(target_fd);
-    std::string response = "User " + target_nickname + " has been invited to channel " + channel_name + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
-    send(target_fd, response.c_str(), response.size(), 0);
+    if (!writeNewFile(trace_path, trace.str())) {
+        std::cerr << "Flight recorder dump failed: cannot create " << trace_path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    std::cerr << "Flight recorder dumped (" << reason << "): " << text_path << " " << trace_path << std::endl;
 }
 
 /**
- * @brief チャネルを作成し、作成者をオペレーターにする。
+ * @brief 遅かった回の記録を書き出す。遅い回が続いても書き出しで更に遅くならないよう、間隔を空ける。
  */
-void Server::createChannel(const std::string &channel_name, int client_fd) {
-    _channels[channel_name] = Channel(channel_name);
-    _channels[channel_name].addOperator(client_fd);
-    std::cout << "Channel created: " << channel_name << std::endl;
+void Server::dumpSlowIteration() {
+    static const long long MIN_INTERVAL_NS = 10LL * 1000000000LL;
+    long long now = FlightRecorder::now();
+    if (_lastSlowDump != 0 && now - _lastSlowDump < MIN_INTERVAL_NS) {
+        return;
+    }
+    _lastSlowDump = now;
+    std::ostringstream reason;
+    reason << "iteration slower than " << _config.recorder.slow_iteration_ms << "ms";
+    dumpFlightRecorder(reason.str());
 }
 
 /**
- * @brief クライアントを既存のチャネルに参加させる。
+ * @brief 読み取り可能な接続を処理する。すでに切断された fd なら何もしない。
  */
-void Server::joinChannel(int client_fd, const std::string &channel_name) {
-    _channels[channel_name].addClient(client_fd);
-    std::string response = "Joined channel " + channel_name + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
+void Server::onReadable(int fd) {
+    if (_clients.find(fd) != _clients.end()) {
+        long long start = FlightRecorder::now();
+        size_t bytes_before = _recorder.bytesIn();
+        handleClient(fd);
+        _recorder.record(FLIGHT_READ, fd, start, _recorder.bytesIn() - bytes_before);
+    }
 }
 
 /**
- * @brief KICKコマンドの処理。特定ユーザーをチャネルから強制退出させる。
+ * @brief 送信待ちを書き出す。すでに切断された fd なら何もしない。
  */
-void Server::handleKickCommand(int client_fd,
-                               const std::string &channel_name,
-                               const std::string &target_nickname) {
-    if (_channels.find(channel_name) == _channels.end()) {
-        std::string error_message = "No such channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
-        return;
+void Server::onWritable(int fd) {
+    if (_clients.find(fd) != _clients.end()) {
+        long long start = FlightRecorder::now();
+        size_t bytes_before = _recorder.bytesOut();
+        flushClient(fd);
+        _recorder.record(FLIGHT_WRITE, fd, start, _recorder.bytesOut() - bytes_before);
     }
-    if (!_channels[channel_name].isOperator(client_fd)) {
-        std::string error_message = "You are not an operator of channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+}
+
+/**
+ * @brief 1回分のイベント処理の後始末。送信待ちの上限を確かめ、送り切った切断予定の接続を閉じる。
+ */
+void Server::finishIteration() {
+    enforceLimits();
+    reapClients();
+}
+
+bool Server::hasPendingOutput(int fd) const {
+    std::map<int, WebSocketSession>::const_iterator ws = _websockets.find(fd);
+    if (ws != _websockets.end() && ws->second.hasOutbound()) {
+        return true;
+    }
+    std::map<int, OutputBuffer>::const_iterator it = _clientOutputs.find(fd);
+    if (it != _clientOutputs.end() && !it->second.empty()) {
+        return true;
+    }
+    it = _chatOutputs.find(fd);
+    return it != _chatOutputs.end() && !it->second.empty();
+}
+
+
+/**
+ * @brief 接続元アドレスをプレフィックスに載せるホスト名にする。AF_UNIX の接続は "localhost"。
+ *        ':' で始まる IPv6 アドレスは引数の区切りと紛れるため、先頭に '0' を付ける。
+ */
+static std::string hostnameOf(const sockaddr_storage &address) {
+    char text[INET6_ADDRSTRLEN];
+    const char *result = NULL;
+    if (address.ss_family == AF_INET) {
+        result = inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&address)->sin_addr,
+                           text, sizeof(text));
+    } else if (address.ss_family == AF_INET6) {
+        result = inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&address)->sin6_addr,
+                           text, sizeof(text));
+    }
+    if (result == NULL) {
+        return "localhost";
+    }
+    std::string host(result);
+    if (host[0] == ':') {
+        host.insert(0, "0");
+    }
+    return host;
+}
+
+/**
+ * @brief 新しいクライアント接続を受け入れる。accept後、クライアントリストに追加し、
+ *        対応バッファを初期化する。登録（PASS/NICK/USER）は通常の行処理の中で行う。
+ */
+void Server::acceptClient(const Listener &listener) {
+    long long start = FlightRecorder::now();
+    sockaddr_storage client_address;
+    socklen_t client_address_len = sizeof(client_address);
+    int client_fd = accept(listener.fd, (struct sockaddr*)&client_address, &client_address_len);
+    if (client_fd < 0) {
+        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+            std::cerr << "Accept failed: " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+
+    // メモリ予算を超えている間、または同時接続数が上限に達している間は新規接続を受け付けない
+    if (_memory.overBudget()) {
+        std::cerr << "Memory budget exceeded. Rejecting new client." << std::endl;
+        close(client_fd);
+        return;
+    }
+    if (_limits.max_connections != 0 && _client_fds.size() >= _limits.max_connections) {
+        std::cerr << "Connection limit reached. Rejecting new client." << std::endl;
+        close(client_fd);
+        return;
+    }
+
+    // クライアントソケットをノンブロッキングに
+    if (!setNonBlocking(client_fd)) {
+        std::cerr << "Failed to set client socket to non-blocking. Closing." << std::endl;
+        close(client_fd);
         return;
     }
+    applyClientOptions(client_fd, _config.socket, listener.family);
+    attachConnection(client_fd, hostnameOf(client_address));
+    if (listener.address.websocket) {
+        _websockets[client_fd] = WebSocketSession();
+    }
+    _recorder.record(FLIGHT_ACCEPT, client_fd, start, 0);
+}
+
+/**
+ * @brief 受け付けた接続をクライアントとして登録し、対応バッファを初期化する。
+ */
+void Server::attachConnection(int client_fd, const std::string &hostname) {
+    // クライアント追加（登録前の初期状態）
+    _client_fds.push_back(client_fd);
+    _clients[client_fd] = ClientInfo(); // デフォルトコンストラクタでstate=REG_NEED_PASSに
+    _clients[client_fd].hostname = hostname;
+    _clientBuffers[client_fd] = std::string();
+    _clientOutputs[client_fd] = OutputBuffer();
+    _clientOutputs[client_fd].attachBudget(&_memory, MEM_OUTPUT_QUEUES);
+    _chatOutputs[client_fd] = OutputBuffer();
+    _chatOutputs[client_fd].attachBudget(&_memory, MEM_OUTPUT_QUEUES);
+    _memory.charge(MEM_CONNECTIONS, CONNECTION_OVERHEAD);
+
+    std::cout << "New client connected: " << client_fd << std::endl;
+}
 
-    int target_fd = -1;
-    for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second.nickname == target_nickname) {
-            target_fd = it->first;
+/**
+ * @brief 接続1つあたりの管理情報（ClientInfo とバッファ類の器、map のノード）の概算バイト数。
+ */
+const size_t Server::CONNECTION_OVERHEAD =
+    sizeof(ClientInfo) + sizeof(std::string) + 2 * sizeof(OutputBuffer) + sizeof(int) + 6 * 48;
+
+/**
+ * @brief 行末の余分な文字列（引数の残り）を取り出す。先頭の空白と ':' を取り除く。
+ */
+static std::string readTrailing(std::istringstream &iss) {
+    std::string rest;
+    std::getline(iss, rest);
+    size_t start = rest.find_first_not_of(' ');
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    if (rest[start] == ':') {
+        ++start;
+    }
+    return rest.substr(start);
+}
+
+/**
+ * @brief クライアントからのデータを読み取り、\n区切りでコマンドに分割。各コマンドを処理する。
+ *        登録前のハンドシェイク（PASS/NICK/USER）も同じ行処理で扱うため、
+ *        1パケットにまとめて送られた PASS/NICK/USER/JOIN も順番どおりに処理される。
+ */
+void Server::handleClient(int client_fd) {
+    // 一時的に受信バッファに読み込み
+    char *tempBuf = &_recvBuffer[0];
+    int valread = _transport->receive(client_fd, tempBuf, _recvBuffer.size());
+
+    if (valread < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            return; // エラーメッセージ表示なし
+        }
+        // その他の実際のエラーの場合
+        removeClient(client_fd);
+        return;
+    }
+    else if (valread == 0) {
+        removeClient(client_fd);
+        return;
+    }
+    _recorder.countBytesIn(valread);
+
+    const char *data = tempBuf;
+    size_t len = valread;
+    // WebSocket の接続はフレームを解いた本文だけを行の切り出しに回す
+    std::string decoded;
+    std::map<int, WebSocketSession>::iterator ws = _websockets.find(client_fd);
+    if (ws != _websockets.end()) {
+        if (!ws->second.receive(tempBuf, valread, decoded)) {
+            _clients[client_fd].quitting = true;
+        }
+        accountWebSocket(ws->second);
+        data = decoded.data();
+        len = decoded.size();
+        if (len == 0) {
+            return;
+        }
+    }
+    // 長すぎる行の残りは、次の改行までまとめて読み捨てる
+    if (_clients[client_fd].discarding_line) {
+        const char *newline = static_cast<const char*>(std::memchr(data, '\n', len));
+        if (newline == NULL) {
+            return;
+        }
+        _clients[client_fd].discarding_line = false;
+        len -= newline + 1 - data;
+        data = newline + 1;
+    }
+
+    std::string &input = _clientBuffers[client_fd];
+    size_t charged = input.capacity();
+    input.append(data, len);
+
+    // 改行(\n)単位でコマンドを切り出す
+    while (true) {
+        // コマンド処理中に切断されることがあるため、毎回バッファを引き直す
+        std::map<int, std::string>::iterator it = _clientBuffers.find(client_fd);
+        if (it == _clientBuffers.end()) {
+            return;
+        }
+        std::string &bufRef = it->second;
+        size_t pos = bufRef.find('\n');
+        if (pos == std::string::npos || _clients[client_fd].quitting) {
+            // 改行のないまま上限を超えたら、その行は捨てて次の改行まで読み飛ばす
+            if (pos == std::string::npos && bufRef.size() >= _limits.max_line_length) {
+                formatReply(outputOf(client_fd), ERR_INPUTTOOLONG, _clients[client_fd].nickname);
+                bufRef.clear();
+                _clients[client_fd].discarding_line = true;
+            }
+            if (bufRef.empty() && bufRef.capacity() > 2 * _limits.max_line_length) {
+                std::string().swap(bufRef);
+            }
+            _memory.adjust(MEM_INPUT_BUFFERS, charged, bufRef.capacity());
             break;
         }
+        // 上限を超える行は処理せずに捨てる
+        if (pos + 1 > _limits.max_line_length) {
+            formatReply(outputOf(client_fd), ERR_INPUTTOOLONG, _clients[client_fd].nickname);
+            bufRef.erase(0, pos + 1);
+            continue;
+        }
+        // 1行分のコマンド（CRLFの\rも取り除く）
+        std::string line = bufRef.substr(0, pos);
+        bufRef.erase(0, pos + 1);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+
+        if (line.empty()) {
+            continue;
+        }
+        long long start = FlightRecorder::now();
+        processCommand(client_fd, line);
+        _recorder.record(FLIGHT_COMMAND, client_fd, start, line.size(), line);
+    }
+}
+
+/**
+ * @brief 1行分のコマンドを解析し、対応するハンドラを呼び出す。
+ *        登録完了前は PASS/NICK/USER（と無視してよい CAP）だけを受け付ける。
+ */
+void Server::processCommand(int client_fd, const std::string &line) {
+    // コマンド文字列を解析
+    std::istringstream iss(line);
+    std::string command;
+    iss >> command;
+
+    if (command == "PASS") {
+        std::string password;
+        iss >> password;
+        handlePassCommand(client_fd, password);
+        return;
+    } else if (command == "NICK") {
+        std::string nickname;
+        iss >> nickname;
+        handleNickCommand(client_fd, nickname);
+        return;
+    } else if (command == "USER") {
+        std::string username, mode, unused;
+        iss >> username >> mode >> unused;
+        handleUserCommand(client_fd, username, readTrailing(iss));
+        return;
+    } else if (command == "CAP") {
+        // 機能ネゴシエーションには対応しないため黙って無視する
+        return;
+    } else if (command == "QUIT") {
+        handleQuitCommand(client_fd, readTrailing(iss));
+        return;
+    }
+
+    if (!_clients[client_fd].isRegistered()) {
+        formatReply(outputOf(client_fd), ERR_NOTREGISTERED, _clients[client_fd].nickname);
+        return;
+    }
+
+    if (command == "JOIN") {
+        std::string channel_name;
+        std::string password;
+        iss >> channel_name >> password;
+        handleJoinCommand(client_fd, channel_name, password);
+    } else if (command == "PRIVMSG") {
+        std::string target;
+        iss >> target;
+        // メッセージの残りをすべて取得
+        handlePrivmsgCommand(client_fd, target, readTrailing(iss));
+    } else if (command == "KICK") {
+        std::string channel_name, target_nickname;
+        iss >> channel_name >> target_nickname;
+        handleKickCommand(client_fd, channel_name, target_nickname, readTrailing(iss));
+    } else if (command == "MODE") {
+        std::string channel_name, mode, parameter;
+        iss >> channel_name >> mode >> parameter;
+        handleModeCommand(client_fd, channel_name, mode, parameter);
+    } else if (command == "INVITE") {
+        std::string target_nickname, channel_name;
+        iss >> target_nickname >> channel_name;
+        handleInviteCommand(client_fd, target_nickname, channel_name);
+    } else if (command == "TOPIC") {
+        // トピックを変更または取得
+        std::string channel_name;
+        iss >> channel_name;
+        handleTopicCommand(client_fd, channel_name, readTrailing(iss));
+    } else if (command == "PART") {
+        std::string channel_list;
+        iss >> channel_list;
+        handlePartCommand(client_fd, channel_list, readTrailing(iss));
+    } else if (command == "NAMES") {
+        std::string channel_list;
+        iss >> channel_list;
+        handleNamesCommand(client_fd, channel_list);
+    } else if (command == "WHO") {
+        std::string mask;
+        iss >> mask;
+        handleWhoCommand(client_fd, mask);
+    } else if (command == "LIST") {
+        std::string channel_list;
+        iss >> channel_list;
+        handleListCommand(client_fd, channel_list);
+    } else if (command == "STATS") {
+        std::string query;
+        iss >> query;
+        handleStatsCommand(client_fd, query);
+    } else {
+        formatReply(outputOf(client_fd), ERR_UNKNOWNCOMMAND, _clients[client_fd].nickname, command);
+    }
+}
+
+/**
+ * @brief 登録に必要な情報（PASS/NICK/USER）がそろっていれば登録を完了し、歓迎メッセージを送る。
+ */
+void Server::completeRegistration(int client_fd) {
+    ClientInfo &client = _clients[client_fd];
+    if (client.state != REG_NEED_IDENTITY) {
+        return;
+    }
+    if (client.nickname.empty() || client.username.empty()) {
+        return;
+    }
+    // 登録前に選んだニックネームを、先に登録を終えた人が使い始めていたら選び直させる
+    if (_nicknames.find(client.nickname) != _nicknames.end()) {
+        formatReply(outputOf(client_fd), ERR_NICKNAMEINUSE, std::string("*"), client.nickname);
+        client.nickname.clear();
+        return;
+    }
+    client.state = REG_DONE;
+    _nicknames[client.nickname] = client_fd;
+    const std::string mask = client.nickname + "!" + client.username + "@" + client.hostname;
+    formatReply(outputOf(client_fd), RPL_WELCOME, client.nickname, mask);
+}
+
+/**
+ * @brief PASSコマンドの処理。接続パスワードと比較し、不一致なら切断する。
+ */
+void Server::handlePassCommand(int client_fd, const std::string &password) {
+    ClientInfo &client = _clients[client_fd];
+    if (client.state != REG_NEED_PASS) {
+        formatReply(outputOf(client_fd), ERR_ALREADYREGISTRED, client.nickname);
+        return;
+    }
+    if (password.empty()) {
+        static const std::string command("PASS");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, client.nickname, command);
+        return;
+    }
+    if (password != _password) {
+        // エラーを送り切ってから切断する
+        formatReply(outputOf(client_fd), ERR_PASSWDMISMATCH, client.nickname);
+        client.quitting = true;
+        return;
+    }
+    client.state = REG_NEED_IDENTITY;
+    completeRegistration(client_fd);
+}
+
+/**
+ * @brief クライアントのニックネームを設定。登録済みなら変更を本人と同じチャネルのメンバーに通知する。
+ */
+void Server::handleNickCommand(int client_fd, const std::string &nickname) {
+    ClientInfo &client = _clients[client_fd];
+    if (nickname.empty()) {
+        formatReply(outputOf(client_fd), ERR_NONICKNAMEGIVEN, client.nickname);
+        return;
+    }
+    int owner_fd = findClientFd(nickname);
+    if (owner_fd != -1 && owner_fd != client_fd) {
+        formatReply(outputOf(client_fd), ERR_NICKNAMEINUSE, client.nickname, nickname);
+        return;
+    }
+    if (!client.isRegistered()) {
+        client.nickname = nickname;
+        completeRegistration(client_fd);
+        return;
+    }
+
+    // 旧ニックネームをプレフィックスにして通知文を一度だけ整形する
+    _broadcastBuffer.clear();
+    formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_NICK, nickname);
+    _nicknames.erase(client.nickname);
+    _nicknames[nickname] = client_fd;
+    client.nickname = nickname;
+
+    std::set<int> recipients;
+    recipients.insert(client_fd);
+    for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        if (it->second.hasClient(client_fd)) {
+            const std::vector<int>& clients = it->second.getClients();
+            recipients.insert(clients.begin(), clients.end());
+            // NAMES/WHO に出るニックネームが変わったので、この人の分を描き直させる
+            it->second.touchMember(client_fd);
+        }
+    }
+    for (std::set<int>::iterator it = recipients.begin(); it != recipients.end(); ++it) {
+        outputOf(*it).append(_broadcastBuffer.data(), _broadcastBuffer.size());
+    }
+}
+
+/**
+ * @brief クライアントのユーザー名を設定する。登録完了後は変更できない。
+ */
+void Server::handleUserCommand(int client_fd, const std::string &username, const std::string &realname) {
+    ClientInfo &client = _clients[client_fd];
+    if (client.isRegistered()) {
+        formatReply(outputOf(client_fd), ERR_ALREADYREGISTRED, client.nickname);
+        return;
+    }
+    if (username.empty()) {
+        static const std::string command("USER");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, client.nickname, command);
+        return;
+    }
+    client.username = username;
+    client.realname = realname;
+    completeRegistration(client_fd);
+}
+
+/**
+ * @brief LIST の人数条件（">N" / "<N" の N）を読む。数字だけからなる、表せる範囲の数のときだけ true。
+ */
+static bool parseMemberCount(const std::string &text, size_t &out) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    errno = 0;
+    unsigned long number = std::strtoul(text.c_str(), NULL, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+    out = number;
+    return true;
+}
+
+/**
+ * @brief カンマ区切りのリストを要素ごとに分割する。空要素も位置を保つため残す。
+ */
+static std::vector<std::string> splitList(const std::string &list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+/**
+ * @brief クライアントをチャネルに参加させるコマンドJOINの処理。
+ *        チャネル名・キーはカンマ区切りで複数指定でき、n番目のキーがn番目のチャネルに対応する。
+ *        リスト全体の結果は出力領域にまとめて積まれ、1回の送信で返る。
+ */
+void Server::handleJoinCommand(int client_fd, const std::string &channel_list, const std::string &key_list) {
+    if (channel_list.empty()) {
+        static const std::string command("JOIN");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, _clients[client_fd].nickname, command);
+        return;
+    }
+    std::vector<std::string> channel_names = splitList(channel_list);
+    std::vector<std::string> keys;
+    if (!key_list.empty()) {
+        keys = splitList(key_list);
+    }
+
+    for (size_t i = 0; i < channel_names.size(); ++i) {
+        const std::string &channel_name = channel_names[i];
+        if (channel_name.empty()) {
+            continue;
+        }
+        joinOneChannel(client_fd, channel_name, (i < keys.size()) ? keys[i] : NO_ARG);
+    }
+}
+
+/**
+ * @brief JOINリストのうち1チャネル分を処理する。
+ */
+void Server::joinOneChannel(int client_fd, const std::string &channel_name, const std::string &password) {
+    std::map<std::string, Channel>::iterator it = _channels.find(channel_name);
+    if (it == _channels.end()) {
+        createChannel(channel_name, client_fd);
+    } else {
+        Channel &ch = it->second;
+        const std::vector<int>& clients = ch.getClients();
+        const std::string &nick = _clients[client_fd].nickname;
+        // 参加済みのチャネルは重複登録しない
+        if (std::find(clients.begin(), clients.end(), client_fd) != clients.end()) {
+            return;
+        }
+
+        // +bモードのチェック
+        const ClientInfo &client = _clients[client_fd];
+        if (ch.isBanned(client.nickname, client.username, client.hostname)) {
+            formatReply(outputOf(client_fd), ERR_BANNEDFROMCHAN, nick, channel_name);
+            return;
+        }
+
+        // +iモードのチェック
+        if (ch.hasMode('i') && !ch.isInvitee(client_fd)) {
+            formatReply(outputOf(client_fd), ERR_INVITEONLYCHAN, nick, channel_name);
+            return;
+        }
+
+        // +kモードのチェック
+        if (ch.hasMode('k') && !ch.checkPassword(password)) {
+            formatReply(outputOf(client_fd), ERR_BADCHANNELKEY, nick, channel_name);
+            return;
+        }
+
+        // +lモードのチェック
+        if (ch.hasMode('l') && ch.isUserLimitReached()) {
+            formatReply(outputOf(client_fd), ERR_CHANNELISFULL, nick, channel_name);
+            return;
+        }
+    }
+    joinChannel(client_fd, channel_name);
+}
+
+/**
+ * @brief PRIVMSGコマンドの処理。ターゲットはカンマ区切りで複数指定でき、
+ *        チャネルとユーザーが混在してもよい。ターゲットが重なっても各受信者には1回だけ届ける。
+ */
+void Server::handlePrivmsgCommand(int client_fd,
+                            const std::string &target_list,
+                            const std::string &message) {
+    const std::string &nick = _clients[client_fd].nickname;
+    if (target_list.empty()) {
+        static const std::string command("PRIVMSG");
+        formatReply(outputOf(client_fd), ERR_NORECIPIENT, nick, command);
+        return;
+    }
+    if (message.empty()) {
+        formatReply(outputOf(client_fd), ERR_NOTEXTTOSEND, nick);
+        return;
+    }
+
+    std::vector<std::string> targets = splitList(target_list);
+    // 受信者FD -> その受信者に見せる宛先（最初に該当したターゲット）
+    std::map<int, const std::string*> recipients;
+
+    for (size_t t = 0; t < targets.size(); ++t) {
+        const std::string &target = targets[t];
+        if (target.empty()) {
+            continue;
+        }
+        std::map<std::string, Channel>::iterator ch_it = _channels.find(target);
+        if (ch_it != _channels.end()) {
+            // チャネルに送信
+            const Channel &ch = ch_it->second;
+            const std::vector<int>& clients = ch.getClients();
+
+            // チャンネルのメンバーでない場合、またはモデレート中で発言権がない場合
+            if (std::find(clients.begin(), clients.end(), client_fd) == clients.end() ||
+                (ch.hasMode('m') && !ch.isOperator(client_fd))) {
+                formatReply(outputOf(client_fd), ERR_CANNOTSENDTOCHAN, nick, target);
+                continue;
+            }
+            // 同じチャネルの他のクライアントを受信者に加える
+            for (size_t i = 0; i < clients.size(); ++i) {
+                if (clients[i] != client_fd) {
+                    recipients.insert(std::make_pair(clients[i], &target));
+                }
+            }
+        } else {
+            // 個人に送信
+            int target_fd = findClientFd(target);
+            if (target_fd == -1) {
+                formatReply(outputOf(client_fd), ERR_NOSUCHNICK, nick, target);
+                continue;
+            }
+            recipients.insert(std::make_pair(target_fd, &target));
+        }
     }
+
+    if (recipients.empty()) {
+        return;
+    }
+    // チャネルの発言は後回しにできる送信待ちへ、個人宛ては応答と同じ送信待ちへ積む
+    const MessageSource source = sourceOf(client_fd);
+    for (std::map<int, const std::string*>::iterator it = recipients.begin(); it != recipients.end(); ++it) {
+        if (_channels.find(*it->second) != _channels.end()) {
+            formatMessage(chatOf(it->first), source, MSG_PRIVMSG, *it->second, message);
+            trimChat(it->first);
+        } else {
+            formatMessage(outputOf(it->first), source, MSG_PRIVMSG, *it->second, message);
+        }
+    }
+}
+
+/**
+ * @brief INVITEコマンドの処理。指定ユーザーをチャネルに招待する。
+ */
+void Server::handleInviteCommand(int client_fd,
+                                 const std::string &target_nickname,
+                                 const std::string &channel_name) {
+    inviteUser(client_fd, channel_name, target_nickname);
+}
+
+/**
+ * @brief チャネルを作成し、作成者をオペレーターにする。
+ */
+void Server::createChannel(const std::string &channel_name, int client_fd) {
+    _channels[channel_name] = Channel(channel_name);
+    _channels[channel_name].addOperator(client_fd);
+    _channelIndex.insert(channel_name, 0);
+    accountChannel(_channels[channel_name]);
+    std::cout << "Channel created: " << channel_name << std::endl;
+}
+
+/**
+ * @brief クライアントを既存のチャネルに参加させ、参加をメンバー全員（本人を含む）に通知する。
+ *        トピックが設定されていれば本人に送る。
+ */
+void Server::joinChannel(int client_fd, const std::string &channel_name) {
+    Channel &ch = _channels[channel_name];
+    ch.addClient(client_fd);
+    _channelIndex.update(channel_name, ch.getClients().size());
+
+    _broadcastBuffer.clear();
+    formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_JOIN, channel_name);
+    broadcast(ch, -1);
+    const std::string &nick = _clients[client_fd].nickname;
+    if (!ch.getTopic().empty()) {
+        formatReply(outputOf(client_fd), RPL_TOPIC, nick, channel_name, ch.getTopic());
+    }
+    sendNames(client_fd, ch);
+    formatReply(outputOf(client_fd), RPL_ENDOFNAMES, nick, channel_name);
+    accountChannel(ch);
+}
+
+/**
+ * @brief KICKコマンドの処理。特定ユーザーをチャネルから強制退出させる。
+ */
+void Server::handleKickCommand(int client_fd,
+                               const std::string &channel_name,
+                               const std::string &target_nickname,
+                               const std::string &reason) {
+    const std::string &nick = _clients[client_fd].nickname;
+    if (channel_name.empty() || target_nickname.empty()) {
+        static const std::string command("KICK");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_name);
+    if (ch_it == _channels.end()) {
+        formatReply(outputOf(client_fd), ERR_NOSUCHCHANNEL, nick, channel_name);
+        return;
+    }
+    Channel &ch = ch_it->second;
+    if (!ch.isOperator(client_fd)) {
+        formatReply(outputOf(client_fd), ERR_CHANOPRIVSNEEDED, nick, channel_name);
+        return;
+    }
+
+    int target_fd = findClientFd(target_nickname);
     if (target_fd == -1) {
-        std::string error_message = "No such user or channel: " + target_nickname + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+        formatReply(outputOf(client_fd), ERR_NOSUCHNICK, nick, target_nickname);
+        return;
+    }
+    const std::vector<int>& clients = ch.getClients();
+    if (std::find(clients.begin(), clients.end(), target_fd) == clients.end()) {
+        formatReply(outputOf(client_fd), ERR_USERNOTINCHANNEL, nick, target_nickname, channel_name);
         return;
     }
 
-    _channels[channel_name].removeClient(target_fd);
-    std::string response = "User " + target_nickname + " has been kicked from channel " + channel_name + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
-    send(target_fd, response.c_str(), response.size(), 0);
+    // 退出させる前に、対象を含むメンバー全員へ通知する
+    _broadcastBuffer.clear();
+    formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_KICK, channel_name, target_nickname,
+                  reason.empty() ? nick : reason);
+    broadcast(ch, -1);
+    ch.removeClient(target_fd);
+    _channelIndex.update(channel_name, ch.getClients().size());
+    if (ch.getClients().empty()) {
+        destroyChannel(channel_name);
+    } else {
+        accountChannel(ch);
+    }
 }
 
 /**
  * @brief MODEコマンドの処理。チャンネルモードを追加・削除する。
+ *        モード文字列を省略すると現在のチャンネルモードを返す。
  */
 void Server::handleModeCommand(int client_fd,
                                 const std::string &channel_name,
                                 const std::string &mode,
                                 const std::string &parameter) {
-    if (_channels.find(channel_name) == _channels.end()) {
-        std::string error_message = "No such channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    static const std::string command("MODE");
+    const std::string &nick = _clients[client_fd].nickname;
+    if (channel_name.empty()) {
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_name);
+    if (ch_it == _channels.end()) {
+        formatReply(outputOf(client_fd), ERR_NOSUCHCHANNEL, nick, channel_name);
+        return;
+    }
+    Channel &ch = ch_it->second;
+
+    // モード照会
+    if (mode.empty()) {
+        std::string modes = "+";
+        std::string params;
+        static const char listed[] = "iklmt";
+        for (size_t i = 0; listed[i] != '\0'; ++i) {
+            if (ch.hasMode(listed[i])) {
+                modes += listed[i];
+            }
+        }
+        if (ch.hasMode('l')) {
+            std::ostringstream oss;
+            oss << ch.getUserLimit();
+            params = oss.str();
+        }
+        formatReply(outputOf(client_fd), RPL_CHANNELMODEIS, nick, channel_name, modes, params);
+        return;
+    }
+
+    // バンリスト照会（オペレータでなくても見られる）
+    if ((mode == "b" || mode == "+b") && parameter.empty()) {
+        const std::vector<BanList::Entry> &bans = ch.getBans();
+        for (size_t i = 0; i < bans.size(); ++i) {
+            std::ostringstream oss;
+            oss << bans[i].setter << " " << bans[i].set_at;
+            formatReply(outputOf(client_fd), RPL_BANLIST, nick, channel_name, bans[i].mask, oss.str());
+        }
+        formatReply(outputOf(client_fd), RPL_ENDOFBANLIST, nick, channel_name);
+        return;
+    }
+
+    if (!ch.isOperator(client_fd)) {
+        formatReply(outputOf(client_fd), ERR_CHANOPRIVSNEEDED, nick, channel_name);
         return;
     }
-    if (!_channels[channel_name].isOperator(client_fd)) {
-        std::string error_message = "You are not an operator of channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+
+    if (mode.size() < 2 || (mode[0] != '+' && mode[0] != '-')) {
+        formatReply(outputOf(client_fd), ERR_UNKNOWNMODE, nick, mode, channel_name);
         return;
     }
+    if (std::strchr("biklmot", mode[1]) == NULL) {
+        formatReply(outputOf(client_fd), ERR_UNKNOWNMODE, nick, std::string(1, mode[1]), channel_name);
+        return;
+    }
+
+    std::string shown_parameter = parameter;   // 通知に載せる引数（バンマスクは正規化した形）
+    if (mode[0] == '+') {
+        // +bモードの場合、マスクをバンリストに加える（登録済みなら何もしない）
+        if (mode[1] == 'b') {
+            shown_parameter = BanList::normalize(parameter);
+            const ClientInfo &setter = _clients[client_fd];
+            if (!ch.addBan(parameter, setter.nickname + "!" + setter.username + "@" + setter.hostname)) {
+                return;
+            }
+        }
+        // +kモードの場合、パスワードが必須
+        else if (mode[1] == 'k') {
+            if (parameter.empty()) {
+                // パスワードが指定されていない場合はエラー
+                formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+                return; // モード設定せずに終了
+            }
+            // パスワードがある場合は正常処理
+            ch.addMode(mode[1]);
+            ch.setPassword(parameter);
+        }
+        // +lモードの場合、数値パラメータが必須
+        else if (mode[1] == 'l') {
+            // 正の値かチェック（数値でなければ0になる）
+            int limit = std::atoi(parameter.c_str());
+            if (limit <= 0) {
+                formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+                return;
+            }
+            // 上限を設定
+            ch.addMode(mode[1]);
+            ch.setUserLimit(limit);
+        }
+        else if (mode[1] == 'o') {
+            if (parameter.empty()) {
+                formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+                return;
+            }
+
+            // 指定されたユーザーが存在するか確認
+            int target_fd = findClientFd(parameter);
+            if (target_fd == -1) {
+                formatReply(outputOf(client_fd), ERR_NOSUCHNICK, nick, parameter);
+                return;
+            }
 
-    if (mode.size() >= 2) {
-        if (mode[0] == '+') {
-            // +kモードの場合、パスワードが必須
-            if (mode[1] == 'k') {
-                if (parameter.empty()) {
-                    // パスワードが指定されていない場合はエラー
-                    std::string error_message = "MODE +k requires a password parameter\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return; // モード設定せずに終了
-                }
-                // パスワードがある場合は正常処理
-                _channels[channel_name].addMode(mode[1]);
-                _channels[channel_name].setPassword(parameter);
-                std::cout << "DEBUG: Set password for " << channel_name << ": '" << parameter << "'" << std::endl;
-            } 
-            // +lモードの場合、数値パラメータが必須
-            else if (mode[1] == 'l') {
-                if (parameter.empty()) {
-                    // ユーザー数上限が指定されていない場合はエラー
-                    std::string error_message = "MODE +l requires a numeric parameter\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return; // モード設定せずに終了
-                }
+            // ユーザーがチャンネルのメンバーか確認
+            const std::vector<int>& clients = ch.getClients();
+            if (std::find(clients.begin(), clients.end(), target_fd) == clients.end()) {
+                formatReply(outputOf(client_fd), ERR_USERNOTINCHANNEL, nick, parameter, channel_name);
+                return;
+            }
 
-                // パラメータが数値かチェック
-                int limit = 0;
-                try {
-                    limit = std::atoi(parameter.c_str());
-                } catch (std::exception &e) {
-                    std::string error_message = "MODE +l requires a valid numeric parameter\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
+            // オペレータ権限を付与
+            ch.addOperator(target_fd);
+        } else {
+            // その他のモードは通常通り設定
+            ch.addMode(mode[1]);
+        }
+    } else {
+        // -bモードの場合、マスクをバンリストから外す（登録がなければ何もしない）
+        if (mode[1] == 'b') {
+            if (parameter.empty()) {
+                formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+                return;
+            }
+            shown_parameter = BanList::normalize(parameter);
+            if (!ch.removeBan(parameter)) {
+                return;
+            }
+        }
+        // -kモードの場合はパスワードをクリア
+        else if (mode[1] == 'k') {
+            ch.removeMode(mode[1]);
+            ch.setPassword("");
+        }
+        // -lモードの場合はユーザー数上限をクリア
+        else if (mode[1] == 'l') {
+            ch.removeMode(mode[1]);
+            ch.setUserLimit(0); // 0は無制限
+        }
+        else if (mode[1] == 'o') {
+            if (parameter.empty()) {
+                formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+                return;
+            }
 
-                // 正の値かチェック
-                if (limit <= 0) {
-                    std::string error_message = "User limit must be a positive number\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                // 上限を設定
-                _channels[channel_name].addMode(mode[1]);
-                _channels[channel_name].setUserLimit(limit);
-                std::cout << "DEBUG: Set user limit for " << channel_name << " to " << limit << std::endl;
-            } 
-            else if (mode[1] == 'o') {
-                if (parameter.empty()) {
-                    std::string error_message = "MODE +o requires a nickname parameter\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                
-                // 指定されたユーザーが存在するか確認
-                int target_fd = -1;
-                for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-                    if (it->second.nickname == parameter) {
-                        target_fd = it->first;
-                        break;
-                    }
-                }
-                
-                if (target_fd == -1) {
-                    std::string error_message = "No such user or channel: " + parameter + "\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                
-                // ユーザーがチャンネルのメンバーか確認
-                const std::vector<int>& clients = _channels[channel_name].getClients();
-                if (std::find(clients.begin(), clients.end(), target_fd) == clients.end()) {
-                    std::string error_message = "User " + parameter + " is not in channel " + channel_name + "\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                
-                // オペレータ権限を付与
-                _channels[channel_name].addOperator(target_fd);
-                _channels[channel_name].addMode(mode[1]);  // モードは必要に応じて
-                std::cout << "DEBUG: Set operator " << parameter << " for " << channel_name << std::endl;
-            } else {
-                // その他のモードは通常通り設定
-                _channels[channel_name].addMode(mode[1]);
-            }
-        } else if (mode[0] == '-') {
-            _channels[channel_name].removeMode(mode[1]);
-            // -kモードの場合はパスワードをクリア
-            if (mode[1] == 'k') {
-                _channels[channel_name].setPassword("");
-            }
-            // -lモードの場合はユーザー数上限をクリア
-            else if (mode[1] == 'l') {
-                _channels[channel_name].setUserLimit(0); // 0は無制限
-            }
-            else if (mode[1] == 'o') {
-                if (parameter.empty()) {
-                    std::string error_message = "MODE -o requires a nickname parameter\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                
-                int target_fd = -1;
-                for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-                    if (it->second.nickname == parameter) {
-                        target_fd = it->first;
-                        break;
-                    }
-                }
-                
-                if (target_fd == -1) {
-                    std::string error_message = "No such user or channel: " + parameter + "\n";
-                    send(client_fd, error_message.c_str(), error_message.size(), 0);
-                    return;
-                }
-                
-                // オペレータ権限を剥奪
-                _channels[channel_name].removeOperator(target_fd);
-                _channels[channel_name].removeMode(mode[1]);  // モードは必要に応じて
+            int target_fd = findClientFd(parameter);
+            if (target_fd == -1) {
+                formatReply(outputOf(client_fd), ERR_NOSUCHNICK, nick, parameter);
+                return;
             }
-            else {
-                _channels[channel_name].removeMode(mode[1]);
+            if (!ch.hasClient(target_fd)) {
+                formatReply(outputOf(client_fd), ERR_USERNOTINCHANNEL, nick, parameter, channel_name);
+                return;
             }
+
+            // オペレータ権限を剥奪
+            ch.removeOperator(target_fd);
+        }
+        else {
+            ch.removeMode(mode[1]);
         }
     }
 
-    std::string response = "Channel mode for " + channel_name + " changed to " + mode + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
+    accountChannel(ch);
+
+    // 変更をメンバー全員に通知する（-kの鍵は通知しない）
+    bool has_parameter = (mode[1] == 'o' || mode[1] == 'b' ||
+                          (mode[0] == '+' && (mode[1] == 'k' || mode[1] == 'l')));
+    _broadcastBuffer.clear();
+    formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_MODE, channel_name, mode,
+                  has_parameter ? shown_parameter : NO_ARG);
+    broadcast(ch, -1);
+    const std::vector<int>& clients = ch.getClients();
+    if (std::find(clients.begin(), clients.end(), client_fd) == clients.end()) {
+        outputOf(client_fd).append(_broadcastBuffer.data(), _broadcastBuffer.size());
+    }
 }
 
 /**
@@ -665,27 +1499,199 @@ void Server::handleModeCommand(int client_fd,
 void Server::handleTopicCommand(int client_fd,
                                 const std::string &channel_name,
                                 const std::string &new_topic) {
-    if (_channels.find(channel_name) == _channels.end()) {
-        std::string error_message = "No such channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    const std::string &nick = _clients[client_fd].nickname;
+    std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_name);
+    if (ch_it == _channels.end()) {
+        formatReply(outputOf(client_fd), ERR_NOSUCHCHANNEL, nick, channel_name);
         return;
     }
     // トピックの取得・設定
-    Channel &ch = _channels[channel_name];
+    Channel &ch = ch_it->second;
     if (new_topic.empty()) {
         // 取得
-        std::string response = "Topic of " + channel_name + ": " + ch.getTopic() + "\n";
-        send(client_fd, response.c_str(), response.size(), 0);
+        if (ch.getTopic().empty()) {
+            formatReply(outputOf(client_fd), RPL_NOTOPIC, nick, channel_name);
+        } else {
+            formatReply(outputOf(client_fd), RPL_TOPIC, nick, channel_name, ch.getTopic());
+        }
     } else {
+        const std::vector<int>& clients = ch.getClients();
+        if (std::find(clients.begin(), clients.end(), client_fd) == clients.end()) {
+            formatReply(outputOf(client_fd), ERR_NOTONCHANNEL, nick, channel_name);
+            return;
+        }
         // +tが付いていて、かつオペレーター以外は変更不可
         if (ch.hasMode('t') && !ch.isOperator(client_fd)) {
-            std::string error_message = "Topic change is restricted (+t).\n";
-            send(client_fd, error_message.c_str(), error_message.size(), 0);
+            formatReply(outputOf(client_fd), ERR_CHANOPRIVSNEEDED, nick, channel_name);
             return;
         }
         ch.setTopic(new_topic);
-        std::string response = "Topic for " + channel_name + " is set to: " + new_topic + "\n";
-        send(client_fd, response.c_str(), response.size(), 0);
+        accountChannel(ch);
+        _broadcastBuffer.clear();
+        formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_TOPIC, channel_name, new_topic);
+        broadcast(ch, -1);
+    }
+}
+
+/**
+ * @brief 送信待ちデータを書き込めるだけ送る。送り切れなかった分は次の書き込み可能時に回す。
+ *        切断予定のクライアントは送り切った時点で切断する。
+ *
+ * 応答・制御の送信待ちを先に送り、それが空のときだけチャネル発言を送る。
+ * チャネル発言が行の途中までしか送れなかったときは、その行の残りを制御側へ移し、
+ * 次に送る制御の行と混ざらないようにする。
+ */
+void Server::flushClient(int client_fd) {
+    OutputBuffer &out = outputOf(client_fd);
+    OutputBuffer &chat = chatOf(client_fd);
+    std::map<int, WebSocketSession>::iterator ws = _websockets.find(client_fd);
+    if (ws != _websockets.end()) {
+        flushWebSocket(client_fd, ws->second, out, chat);
+        return;
+    }
+    if (!out.empty()) {
+        ssize_t sent = _transport->transmit(client_fd, out.data(), out.size());
+        if (sent < 0) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                removeClient(client_fd);
+            }
+            return;
+        }
+        out.consume(sent);
+        _recorder.countBytesOut(sent);
+    }
+    if (out.empty() && !chat.empty()) {
+        ssize_t sent = _transport->transmit(client_fd, chat.data(), chat.size());
+        if (sent < 0) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                removeClient(client_fd);
+            }
+            return;
+        }
+        _recorder.countBytesOut(sent);
+        size_t done = static_cast<size_t>(sent);
+        if (done > 0 && done < chat.size() && chat.data()[done - 1] != '\n') {
+            const char *newline = static_cast<const char*>(
+                std::memchr(chat.data() + done, '\n', chat.size() - done));
+            size_t rest = newline ? static_cast<size_t>(newline - chat.data()) + 1 - done : chat.size() - done;
+            out.append(chat.data() + done, rest);
+            done += rest;
+        }
+        chat.consume(done);
+    }
+    out.shrink();
+    chat.shrink();
+}
+
+/**
+ * @brief WebSocket の接続へ送る。送信待ちの行は、前回までのフレームを送り切ってから
+ *        FRAME_BATCH バイトほどずつフレームにする。フレームにしていない分は出力領域に残るので、
+ *        送信待ちの上限やチャネル発言の切り捨ての対象になる。
+ */
+void Server::flushWebSocket(int client_fd, WebSocketSession &session, OutputBuffer &out, OutputBuffer &chat) {
+    std::string &wire = session.outbound();
+    if (wire.empty() && !out.empty()) {
+        out.consume(session.frameLines(out.data(), out.size()));
+    } else if (wire.empty() && !chat.empty() && session.state() == WebSocketSession::WS_OPEN) {
+        chat.consume(session.frameLines(chat.data(), chat.size()));
+    }
+    if (!wire.empty()) {
+        ssize_t sent = _transport->transmit(client_fd, wire.data(), wire.size());
+        if (sent < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+            removeClient(client_fd);
+            return;
+        }
+        if (sent > 0) {
+            wire.erase(0, sent);
+            _recorder.countBytesOut(sent);
+        }
+    }
+    // 切断予定でフレームにできない残り（ハンドシェイク前の応答など）は捨てる
+    if (session.state() != WebSocketSession::WS_OPEN && _clients[client_fd].quitting) {
+        out.clear();
+        chat.clear();
+    }
+    out.shrink();
+    chat.shrink();
+    session.shrink();
+    accountWebSocket(session);
+}
+
+/**
+ * @brief WebSocket の接続が持つ受信途中のフレームと送信待ちのフレームを、前回申告した値との差で予算に反映する。
+ */
+void Server::accountWebSocket(WebSocketSession &session) {
+    _memory.adjust(MEM_INPUT_BUFFERS, session.accountedInbound(), session.inboundCapacity());
+    _memory.adjust(MEM_OUTPUT_QUEUES, session.accountedOutbound(), session.outboundCapacity());
+    session.setAccounted(session.inboundCapacity(), session.outboundCapacity());
+}
+
+/**
+ * @brief クライアントの出力領域を返す。
+ */
+OutputBuffer &Server::outputOf(int client_fd) {
+    return _clientOutputs[client_fd];
+}
+
+/**
+ * @brief クライアントのチャネル発言用の出力領域を返す。
+ */
+OutputBuffer &Server::chatOf(int client_fd) {
+    return _chatOutputs[client_fd];
+}
+
+/**
+ * @brief 先頭から行単位で捨てて、送信待ちを limit バイト以下にする。捨てた行数を返す。
+ */
+static size_t dropOldestLines(OutputBuffer &buffer, size_t limit) {
+    size_t dropped = 0;
+    while (buffer.size() > limit) {
+        const char *newline = static_cast<const char*>(std::memchr(buffer.data(), '\n', buffer.size()));
+        buffer.consume(newline ? static_cast<size_t>(newline - buffer.data()) + 1 : buffer.size());
+        ++dropped;
+    }
+    return dropped;
+}
+
+/**
+ * @brief チャネル発言の送信待ちが上限を超えていれば、古い行から捨てる。
+ *        応答・制御の送信待ちには手を付けないので、読み遅れている接続にもモード変更などは届く。
+ */
+void Server::trimChat(int client_fd) {
+    if (_limits.max_chat_queue == 0) {
+        return;
+    }
+    OutputBuffer &chat = chatOf(client_fd);
+    if (chat.size() > _limits.max_chat_queue) {
+        _clients[client_fd].chat_dropped += dropOldestLines(chat, _limits.max_chat_queue);
+    }
+}
+
+/**
+ * @brief クライアントを発信元とするプレフィックス情報を返す。
+ */
+MessageSource Server::sourceOf(int client_fd) {
+    const ClientInfo &client = _clients[client_fd];
+    return MessageSource(client.nickname, client.username, client.hostname);
+}
+
+/**
+ * @brief 登録済みのクライアントをニックネームから引く。見つからなければ-1（登録前の接続には一致しない）。
+ */
+int Server::findClientFd(const std::string &nickname) const {
+    std::map<std::string, int>::const_iterator it = _nicknames.find(nickname);
+    return (it == _nicknames.end()) ? -1 : it->second;
+}
+
+/**
+ * @brief _broadcastBuffer に整形済みのメッセージをチャネルのメンバーへ配る。
+ */
+void Server::broadcast(const Channel &channel, int except_fd) {
+    const std::vector<int>& clients = channel.getClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (clients[i] != except_fd) {
+            outputOf(clients[i]).append(_broadcastBuffer.data(), _broadcastBuffer.size());
+        }
     }
 }
 
@@ -693,48 +1699,493 @@ void Server::handleTopicCommand(int client_fd,
  * @brief クライアント接続を終了し、管理構造から削除する。
  */
 void Server::removeClient(int client_fd) {
-    close(client_fd);
+    long long start = FlightRecorder::now();
+    leaveAllChannels(client_fd, "Connection closed");
+    _transport->disconnect(client_fd);
     _client_fds.erase(std::remove(_client_fds.begin(), _client_fds.end(), client_fd),
                       _client_fds.end());
+    std::map<std::string, int>::iterator named = _nicknames.find(_clients[client_fd].nickname);
+    if (named != _nicknames.end() && named->second == client_fd) {
+        _nicknames.erase(named);
+    }
     _clients.erase(client_fd);
-    _clientBuffers.erase(client_fd);
+    std::map<int, std::string>::iterator input = _clientBuffers.find(client_fd);
+    if (input != _clientBuffers.end()) {
+        _memory.release(MEM_INPUT_BUFFERS, input->second.capacity());
+        _clientBuffers.erase(input);
+    }
+    _memory.release(MEM_CONNECTIONS, CONNECTION_OVERHEAD);
+    _clientOutputs.erase(client_fd);
+    _chatOutputs.erase(client_fd);
+    std::map<int, WebSocketSession>::iterator ws = _websockets.find(client_fd);
+    if (ws != _websockets.end()) {
+        _memory.release(MEM_INPUT_BUFFERS, ws->second.accountedInbound());
+        _memory.release(MEM_OUTPUT_QUEUES, ws->second.accountedOutbound());
+        _websockets.erase(ws);
+    }
+    _recorder.record(FLIGHT_CLOSE, client_fd, start, 0);
     std::cout << "Client disconnected: " << client_fd << std::endl;
 }
 
 /**
- * @brief チャネルにユーザーを招待する（内部用）。
- *        handleInviteCommand()を使用しない別箇所での呼び出し用。
+ * @brief チャネルにユーザーを招待する。
  */
 void Server::inviteUser(int client_fd,
                         const std::string &channel_name,
                         const std::string &target_nickname) {
-    if (_channels.find(channel_name) == _channels.end()) {
-        std::string error_message = "No such channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    const std::string &nick = _clients[client_fd].nickname;
+    if (channel_name.empty() || target_nickname.empty()) {
+        static const std::string command("INVITE");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_name);
+    if (ch_it == _channels.end()) {
+        formatReply(outputOf(client_fd), ERR_NOSUCHCHANNEL, nick, channel_name);
         return;
     }
-    if (!_channels[channel_name].isOperator(client_fd)) {
-        std::string error_message = "You are not an operator of channel: " + channel_name + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+    if (!ch_it->second.isOperator(client_fd)) {
+        formatReply(outputOf(client_fd), ERR_CHANOPRIVSNEEDED, nick, channel_name);
         return;
     }
 
-    int target_fd = -1;
-    for (std::map<int, ClientInfo>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second.nickname == target_nickname) {
-            target_fd = it->first;
-            break;
+    int target_fd = findClientFd(target_nickname);
+    if (target_fd == -1) {
+        formatReply(outputOf(client_fd), ERR_NOSUCHNICK, nick, target_nickname);
+        return;
+    }
+
+    ch_it->second.addInvitee(target_fd);
+    formatReply(outputOf(client_fd), RPL_INVITING, nick, target_nickname, channel_name);
+    formatMessage(outputOf(target_fd), sourceOf(client_fd), MSG_INVITE, target_nickname, channel_name);
+}
+
+/**
+ * @brief PARTコマンドの処理。カンマ区切りで複数のチャネルから抜ける。
+ *        退出はメンバー全員（本人を含む）に通知し、空になったチャネルは破棄する。
+ */
+void Server::handlePartCommand(int client_fd, const std::string &channel_list, const std::string &reason) {
+    const std::string &nick = _clients[client_fd].nickname;
+    if (channel_list.empty()) {
+        static const std::string command("PART");
+        formatReply(outputOf(client_fd), ERR_NEEDMOREPARAMS, nick, command);
+        return;
+    }
+    std::vector<std::string> channel_names = splitList(channel_list);
+    for (size_t i = 0; i < channel_names.size(); ++i) {
+        const std::string &channel_name = channel_names[i];
+        if (channel_name.empty()) {
+            continue;
+        }
+        std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_name);
+        if (ch_it == _channels.end()) {
+            formatReply(outputOf(client_fd), ERR_NOSUCHCHANNEL, nick, channel_name);
+            continue;
+        }
+        Channel &ch = ch_it->second;
+        if (!ch.hasClient(client_fd)) {
+            formatReply(outputOf(client_fd), ERR_NOTONCHANNEL, nick, channel_name);
+            continue;
+        }
+        _broadcastBuffer.clear();
+        formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_PART, channel_name, reason);
+        broadcast(ch, -1);
+        ch.removeClient(client_fd);
+        _channelIndex.update(channel_name, ch.getClients().size());
+        if (ch.getClients().empty()) {
+            destroyChannel(channel_name);
+        } else {
+            accountChannel(ch);
         }
     }
-    if (target_fd == -1) {
-        std::string error_message = "No such user or channel: " + target_nickname + "\n";
-        send(client_fd, error_message.c_str(), error_message.size(), 0);
+}
+
+/**
+ * @brief QUITコマンドの処理。参加中のチャネルのメンバーへ通知し、送信待ちを送り切ってから切断する。
+ */
+void Server::handleQuitCommand(int client_fd, const std::string &reason) {
+    leaveAllChannels(client_fd, reason.empty() ? "Client Quit" : reason);
+    _clients[client_fd].quitting = true;
+}
+
+/**
+ * @brief NAMESコマンドの処理。チャネル指定がなければ全チャネルを返す。
+ *        各チャネルの本文は描画済みキャッシュから出すため、問い合わせのたびに組み立て直さない。
+ */
+void Server::handleNamesCommand(int client_fd, const std::string &channel_list) {
+    const std::string &nick = _clients[client_fd].nickname;
+    if (channel_list.empty()) {
+        for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+            sendNames(client_fd, it->second);
+        }
+        static const std::string all("*");
+        formatReply(outputOf(client_fd), RPL_ENDOFNAMES, nick, all);
+        return;
+    }
+    std::vector<std::string> channel_names = splitList(channel_list);
+    for (size_t i = 0; i < channel_names.size(); ++i) {
+        std::map<std::string, Channel>::iterator ch_it = _channels.find(channel_names[i]);
+        if (ch_it != _channels.end()) {
+            sendNames(client_fd, ch_it->second);
+        }
+        formatReply(outputOf(client_fd), RPL_ENDOFNAMES, nick, channel_names[i]);
+    }
+}
+
+/**
+ * @brief WHOコマンドの処理。チャネル名ならメンバー一覧（キャッシュ）、ニックネームならその1人を返す。
+ */
+void Server::handleWhoCommand(int client_fd, const std::string &mask) {
+    const std::string &nick = _clients[client_fd].nickname;
+    std::map<std::string, Channel>::iterator ch_it = _channels.find(mask);
+    // 対象の指定がなければ RPL_ENDOFWHO だけを返す（ニックネームのない登録前の接続に一致させない）
+    if (mask.empty()) {
+        formatReply(outputOf(client_fd), RPL_ENDOFWHO, nick, std::string("*"));
+        return;
+    }
+    if (ch_it != _channels.end()) {
+        const std::vector<std::string> &lines = renderWho(ch_it->second);
+        for (size_t i = 0; i < lines.size(); ++i) {
+            formatReply(outputOf(client_fd), RPL_WHOREPLY, nick, lines[i]);
+        }
+    } else {
+        int target_fd = findClientFd(mask);
+        if (target_fd != -1) {
+            const ClientInfo &target = _clients[target_fd];
+            const std::string line = "* " + target.username + " " + target.hostname + " " SERVER_NAME " "
+                                   + target.nickname + " H :0 " + target.realname;
+            formatReply(outputOf(client_fd), RPL_WHOREPLY, nick, line);
+        }
+    }
+    formatReply(outputOf(client_fd), RPL_ENDOFWHO, nick, mask);
+}
+
+/**
+ * @brief LISTコマンドの処理。チャネル指定がなければ全チャネルを返す。
+ *        カンマ区切りの各要素には、チャネル名・ワイルドカードを含むマスク（#proj-* など）・
+ *        メンバー数の条件（>N は N 人より多い、<N は N 人より少ない）を指定できる。
+ *        マスクと人数条件はチャネル名インデックスで引くため、全チャネルを走査しない。
+ */
+void Server::handleListCommand(int client_fd, const std::string &channel_list) {
+    const std::string &nick = _clients[client_fd].nickname;
+    OutputBuffer &out = outputOf(client_fd);
+    formatReply(out, RPL_LISTSTART, nick);
+    if (channel_list.empty()) {
+        for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+            formatReply(out, RPL_LIST, nick, renderList(it->second).lines[0]);
+        }
+        formatReply(out, RPL_LISTEND, nick);
+        return;
+    }
+
+    ChannelIndex::Query query;
+    std::vector<std::string> patterns;
+    std::vector<std::string> items = splitList(channel_list);
+    for (size_t i = 0; i < items.size(); ++i) {
+        const std::string &item = items[i];
+        if (item.empty()) {
+            continue;
+        }
+        if (item[0] == '>' || item[0] == '<') {
+            size_t bound;
+            if (!parseMemberCount(item.substr(1), bound)) {
+                continue;  // 数でない・負の人数の条件は無視する
+            }
+            if (item[0] == '>') {
+                // 上限の値より多い人数のチャネルはないので、+1 であふれさせずにそのまま使う
+                query.min_members = std::max(query.min_members, bound < static_cast<size_t>(-1) ? bound + 1 : bound);
+            } else {
+                query.max_members = std::min(query.max_members, bound > 0 ? bound - 1 : 0);
+                if (bound == 0) {
+                    query.min_members = 1;  // 0人未満のチャネルは存在しないので何も返さない
+                }
+            }
+        } else {
+            patterns.push_back(item);
+        }
+    }
+    if (patterns.empty()) {
+        patterns.push_back(std::string());  // 人数条件だけの指定
+    }
+
+    // 複数のマスクに一致したチャネルも1回だけ、名前順で返す
+    std::vector<std::string> found;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        query.pattern = patterns[i];
+        _channelIndex.search(query, found);
+    }
+    std::set<std::string> matched(found.begin(), found.end());
+    for (std::set<std::string>::iterator it = matched.begin(); it != matched.end(); ++it) {
+        std::map<std::string, Channel>::iterator ch_it = _channels.find(*it);
+        if (ch_it != _channels.end()) {
+            formatReply(out, RPL_LIST, nick, renderList(ch_it->second).lines[0]);
+        }
+    }
+    formatReply(out, RPL_LISTEND, nick);
+}
+
+/**
+ * @brief チャネルの RPL_NAMREPLY 本文を返す。1行が長くなりすぎないよう適当な長さで折り返す。
+ *        初回は全員ぶん描き、その後は出入りやニックネーム・権限が変わった人の分だけを直す。
+ */
+const std::vector<std::string> &Server::renderNames(Channel &channel) {
+    static const size_t MAX_NAMES_BODY = 400;
+    Channel::MemberReplyCache &cache = channel.namesCache();
+    if (!cache.valid()) {
+        cache.reset("= " + channel.getName() + " :", MAX_NAMES_BODY);
+        const std::vector<int>& clients = channel.getClients();
+        for (size_t i = 0; i < clients.size(); ++i) {
+            cache.set(clients[i], namesToken(channel, clients[i]));
+        }
+    } else if (cache.stale().empty()) {
+        return cache.lines();
+    }
+    while (!cache.stale().empty()) {
+        int member = *cache.stale().begin();
+        if (channel.hasClient(member)) {
+            cache.set(member, namesToken(channel, member));
+        } else {
+            cache.remove(member);
+        }
+    }
+    accountChannel(channel);
+    return cache.lines();
+}
+
+/**
+ * @brief チャネルの RPL_WHOREPLY 本文（メンバー1人につき1行）を返す。直し方は renderNames と同じ。
+ */
+const std::vector<std::string> &Server::renderWho(Channel &channel) {
+    Channel::MemberReplyCache &cache = channel.whoCache();
+    if (!cache.valid()) {
+        cache.reset("", 0);
+        const std::vector<int>& clients = channel.getClients();
+        for (size_t i = 0; i < clients.size(); ++i) {
+            cache.set(clients[i], whoLine(channel, clients[i]));
+        }
+    } else if (cache.stale().empty()) {
+        return cache.lines();
+    }
+    while (!cache.stale().empty()) {
+        int member = *cache.stale().begin();
+        if (channel.hasClient(member)) {
+            cache.set(member, whoLine(channel, member));
+        } else {
+            cache.remove(member);
+        }
+    }
+    accountChannel(channel);
+    return cache.lines();
+}
+
+std::string Server::namesToken(const Channel &channel, int client_fd) {
+    const std::string &member = _clients[client_fd].nickname;
+    return channel.isOperator(client_fd) ? "@" + member : member;
+}
+
+std::string Server::whoLine(const Channel &channel, int client_fd) {
+    const ClientInfo &member = _clients[client_fd];
+    return channel.getName() + " " + member.username + " " + member.hostname
+         + " " SERVER_NAME " " + member.nickname
+         + (channel.isOperator(client_fd) ? " H@" : " H")
+         + " :0 " + member.realname;
+}
+
+/**
+ * @brief チャネルの RPL_LIST 本文（常に1行）を返す。トピックの前に設定中のモードを付ける。
+ */
+const Channel::ReplyCache &Server::renderList(Channel &channel) {
+    Channel::ReplyCache &cache = channel.listCache();
+    if (cache.valid) {
+        return cache;
+    }
+    std::ostringstream oss;
+    oss << channel.getName() << " " << channel.getClients().size() << " :";
+    std::string modes;
+    static const char listed[] = "iklmt";
+    for (size_t i = 0; listed[i] != '\0'; ++i) {
+        if (channel.hasMode(listed[i])) {
+            modes += listed[i];
+        }
+    }
+    if (!modes.empty()) {
+        oss << "[+" << modes << "] ";
+    }
+    oss << channel.getTopic();
+    cache.lines.assign(1, oss.str());
+    cache.valid = true;
+    accountChannel(channel);
+    return cache;
+}
+
+/**
+ * @brief チャネルの RPL_NAMREPLY を送る（RPL_ENDOFNAMES は呼び出し側で送る）。
+ */
+void Server::sendNames(int client_fd, Channel &channel) {
+    const std::string &nick = _clients[client_fd].nickname;
+    const std::vector<std::string> &lines = renderNames(channel);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        formatReply(outputOf(client_fd), RPL_NAMREPLY, nick, lines[i]);
+    }
+}
+
+/**
+ * @brief メンバーがいなくなったチャネルを破棄する。
+ */
+void Server::destroyChannel(const std::string &channel_name) {
+    std::map<std::string, Channel>::iterator it = _channels.find(channel_name);
+    if (it == _channels.end()) {
+        return;
+    }
+    _memory.release(MEM_CHANNELS, it->second.getAccountedBytes());
+    _channels.erase(it);
+    _channelIndex.erase(channel_name);
+    std::cout << "Channel destroyed: " << channel_name << std::endl;
+}
+
+/**
+ * @brief 参加中の全チャネルから抜け、同じチャネルにいたクライアントへ QUIT を1回ずつ通知する。
+ */
+void Server::leaveAllChannels(int client_fd, const std::string &reason) {
+    std::set<int> peers;
+    std::vector<std::string> emptied;
+    for (std::map<std::string, Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        Channel &ch = it->second;
+        if (!ch.hasClient(client_fd)) {
+            continue;
+        }
+        ch.removeClient(client_fd);
+        const std::vector<int>& clients = ch.getClients();
+        _channelIndex.update(it->first, clients.size());
+        peers.insert(clients.begin(), clients.end());
+        if (clients.empty()) {
+            emptied.push_back(it->first);
+        } else {
+            accountChannel(ch);
+        }
+    }
+    for (size_t i = 0; i < emptied.size(); ++i) {
+        destroyChannel(emptied[i]);
+    }
+    if (peers.empty()) {
         return;
     }
+    _broadcastBuffer.clear();
+    formatMessage(_broadcastBuffer, sourceOf(client_fd), MSG_QUIT, reason);
+    for (std::set<int>::iterator it = peers.begin(); it != peers.end(); ++it) {
+        outputOf(*it).append(_broadcastBuffer.data(), _broadcastBuffer.size());
+    }
+}
+
+/**
+ * @brief STATSコマンドの処理。STATS z でメモリ予算と区分ごとの使用量（概算）を返す。
+ */
+void Server::handleStatsCommand(int client_fd, const std::string &query) {
+    const std::string &nick = _clients[client_fd].nickname;
+    OutputBuffer &out = outputOf(client_fd);
+    if (query == "z" || query == "Z") {
+        for (int i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+            MemoryCategory category = static_cast<MemoryCategory>(i);
+            std::ostringstream oss;
+            oss << "z :" << MemoryBudget::categoryName(category) << " " << _memory.usage(category)
+                << " bytes (peak " << _memory.peak(category) << ")";
+            formatReply(out, RPL_STATSDEBUG, nick, oss.str());
+        }
+        size_t dropped = 0;
+        for (std::map<int, ClientInfo>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+            dropped += it->second.chat_dropped;
+        }
+        std::ostringstream oss;
+        oss << "z :total " << _memory.total() << " bytes of budget " << _memory.limit()
+            << " (" << _client_fds.size() << " connections, " << _channels.size() << " channels)";
+        formatReply(out, RPL_STATSDEBUG, nick, oss.str());
+        std::ostringstream chat;
+        chat << "z :chat lines dropped " << dropped << " (you " << _clients[client_fd].chat_dropped << ")";
+        formatReply(out, RPL_STATSDEBUG, nick, chat.str());
+    }
+    formatReply(out, RPL_ENDOFSTATS, nick, query.empty() ? std::string("*") : query);
+}
+
+/**
+ * @brief 送信待ちが上限を超えた接続を切断予定にする。
+ *        サーバー全体がメモリ予算を超えている間は、まずチャネル発言の送信待ちを大きい順に捨て、
+ *        それでも足りなければ送信待ちの大きい接続から順に切り捨てる。
+ */
+void Server::enforceLimits() {
+    for (size_t i = 0; i < _client_fds.size(); ++i) {
+        int fd = _client_fds[i];
+        OutputBuffer &out = _clientOutputs[fd];
+        // WebSocket の接続は、フレームにして送り切れていない分も送信待ちに数える
+        std::map<int, WebSocketSession>::iterator ws = _websockets.find(fd);
+        size_t framed = (ws != _websockets.end()) ? ws->second.outbound().size() : 0;
+        if (out.size() + framed > _limits.max_output_queue) {
+            std::cerr << "Send queue exceeded for client " << fd << ". Disconnecting." << std::endl;
+            out.clear();
+            out.shrink();
+            _chatOutputs[fd].clear();
+            _chatOutputs[fd].shrink();
+            if (ws != _websockets.end()) {
+                ws->second.outbound().clear();
+            }
+            _clients[fd].quitting = true;
+        }
+    }
+    while (_memory.overBudget()) {
+        int heaviest = -1;
+        size_t heaviest_size = 0;
+        for (size_t i = 0; i < _client_fds.size(); ++i) {
+            int fd = _client_fds[i];
+            if (_chatOutputs[fd].size() > heaviest_size) {
+                heaviest = fd;
+                heaviest_size = _chatOutputs[fd].size();
+            }
+        }
+        if (heaviest == -1) {
+            break;
+        }
+        _clients[heaviest].chat_dropped += dropOldestLines(_chatOutputs[heaviest], 0);
+        _chatOutputs[heaviest].shrink();
+    }
+    while (_memory.overBudget()) {
+        int heaviest = -1;
+        size_t heaviest_size = 0;
+        for (size_t i = 0; i < _client_fds.size(); ++i) {
+            int fd = _client_fds[i];
+            if (_clientOutputs[fd].size() > heaviest_size) {
+                heaviest = fd;
+                heaviest_size = _clientOutputs[fd].size();
+            }
+        }
+        if (heaviest == -1) {
+            break;
+        }
+        std::cerr << "Memory budget exceeded (" << _memory.total() << " bytes). Shedding client "
+                  << heaviest << "." << std::endl;
+        _clientOutputs[heaviest].clear();
+        _clientOutputs[heaviest].shrink();
+        _chatOutputs[heaviest].clear();
+        _chatOutputs[heaviest].shrink();
+        _clients[heaviest].quitting = true;
+    }
+}
 
-    _channels[channel_name].addInvitee(target_fd);
-    std::string response = "User " + target_nickname + " has been invited to channel " + channel_name + "\n";
-    send(client_fd, response.c_str(), response.size(), 0);
-    send(target_fd, response.c_str(), response.size(), 0);
+/**
+ * @brief 切断予定で送信待ちのなくなった接続を閉じる。
+ */
+void Server::reapClients() {
+    std::vector<int> fds(_client_fds);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (_clients[fds[i]].quitting && !hasPendingOutput(fds[i])) {
+            removeClient(fds[i]);
+        }
+    }
 }
 
+/**
+ * @brief チャネルの現在のメモリ使用量を概算し、前回申告した値との差を予算に反映する。
+ */
+void Server::accountChannel(Channel &channel) {
+    size_t bytes = channel.memoryFootprint();
+    _memory.adjust(MEM_CHANNELS, channel.getAccountedBytes(), bytes);
+    channel.setAccountedBytes(bytes);
+}
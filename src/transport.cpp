@@ -0,0 +1,105 @@
+#include "../include/transport.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+ssize_t SocketTransport::receive(int fd, char *buffer, size_t length) {
+    return recv(fd, buffer, length, 0);
+}
+
+ssize_t SocketTransport::transmit(int fd, const char *data, size_t length) {
+    return send(fd, data, length, 0);
+}
+
+void SocketTransport::disconnect(int fd) {
+    close(fd);
+}
+
+MemoryTransport::MemoryTransport() : _next_fd(FIRST_FD), _write_limit(0) {}
+
+/**
+ * @brief 新しい仮想接続を作り、その fd を返す。
+ */
+int MemoryTransport::open() {
+    int fd = _next_fd++;
+    _connections[fd] = Connection();
+    return fd;
+}
+
+/**
+ * @brief クライアントからの入力として data を積む。
+ */
+void MemoryTransport::deliver(int fd, const std::string &data) {
+    _connections[fd].inbound.append(data);
+}
+
+/**
+ * @brief クライアント側から接続を閉じる。積まれた入力を読み切った後の receive は 0 を返す。
+ */
+void MemoryTransport::hangup(int fd) {
+    _connections[fd].peer_closed = true;
+}
+
+/**
+ * @brief サーバーがこの接続へ送った内容。呼び出し側が読み終えたら clear してよい。
+ */
+std::string &MemoryTransport::sent(int fd) {
+    return _connections[fd].outbound;
+}
+
+size_t MemoryTransport::pendingInput(int fd) const {
+    std::map<int, Connection>::const_iterator it = _connections.find(fd);
+    return it == _connections.end() ? 0 : it->second.inbound.size();
+}
+
+bool MemoryTransport::isOpen(int fd) const {
+    std::map<int, Connection>::const_iterator it = _connections.find(fd);
+    return it != _connections.end() && it->second.open;
+}
+
+void MemoryTransport::setWriteLimit(size_t bytes) {
+    _write_limit = bytes;
+}
+
+ssize_t MemoryTransport::receive(int fd, char *buffer, size_t length) {
+    std::map<int, Connection>::iterator it = _connections.find(fd);
+    if (it == _connections.end() || !it->second.open) {
+        errno = EBADF;
+        return -1;
+    }
+    Connection &conn = it->second;
+    if (conn.inbound.empty()) {
+        if (conn.peer_closed) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = (conn.inbound.size() < length) ? conn.inbound.size() : length;
+    std::memcpy(buffer, conn.inbound.data(), n);
+    conn.inbound.erase(0, n);
+    return n;
+}
+
+ssize_t MemoryTransport::transmit(int fd, const char *data, size_t length) {
+    std::map<int, Connection>::iterator it = _connections.find(fd);
+    if (it == _connections.end() || !it->second.open) {
+        errno = EBADF;
+        return -1;
+    }
+    if (it->second.peer_closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    size_t n = (_write_limit != 0 && length > _write_limit) ? _write_limit : length;
+    it->second.outbound.append(data, n);
+    return n;
+}
+
+void MemoryTransport::disconnect(int fd) {
+    std::map<int, Connection>::iterator it = _connections.find(fd);
+    if (it != _connections.end()) {
+        it->second.open = false;
+    }
+}
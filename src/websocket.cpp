@@ -0,0 +1,514 @@
+#include "../include/websocket.hpp"
+#include <stdint.h>
+#include <cstring>
+#include <cctype>
+
+static uint32_t rotateLeft(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+std::string sha1(const std::string &data) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    // 0x80 と長さ（ビット数、ビッグエンディアン64ビット）を付けて64バイト単位にそろえる
+    std::string message(data);
+    message += static_cast<char>(0x80);
+    while (message.size() % 64 != 56) {
+        message += '\0';
+    }
+    unsigned long long bit_length = static_cast<unsigned long long>(data.size()) * 8;
+    for (int i = 7; i >= 0; --i) {
+        message += static_cast<char>((bit_length >> (i * 8)) & 0xff);
+    }
+
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const unsigned char *p = reinterpret_cast<const unsigned char*>(message.data() + chunk + i * 4);
+            w[i] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        }
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f;
+            uint32_t k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    std::string digest;
+    for (int i = 0; i < 5; ++i) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            digest += static_cast<char>((h[i] >> shift) & 0xff);
+        }
+    }
+    return digest;
+}
+
+std::string base64Encode(const std::string &data) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    size_t i = 0;
+    for (; i + 2 < data.size(); i += 3) {
+        unsigned int n = (static_cast<unsigned char>(data[i]) << 16) |
+                         (static_cast<unsigned char>(data[i + 1]) << 8) |
+                         static_cast<unsigned char>(data[i + 2]);
+        encoded += table[(n >> 18) & 63];
+        encoded += table[(n >> 12) & 63];
+        encoded += table[(n >> 6) & 63];
+        encoded += table[n & 63];
+    }
+    if (i < data.size()) {
+        unsigned int n = static_cast<unsigned char>(data[i]) << 16;
+        if (i + 1 < data.size()) {
+            n |= static_cast<unsigned char>(data[i + 1]) << 8;
+        }
+        encoded += table[(n >> 18) & 63];
+        encoded += table[(n >> 12) & 63];
+        encoded += (i + 1 < data.size()) ? table[(n >> 6) & 63] : '=';
+        encoded += '=';
+    }
+    return encoded;
+}
+
+std::string websocketAcceptKey(const std::string &key) {
+    return base64Encode(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+}
+
+static std::string toLower(const std::string &str) {
+    std::string lowered(str);
+    for (size_t i = 0; i < lowered.size(); ++i) {
+        lowered[i] = std::tolower(static_cast<unsigned char>(lowered[i]));
+    }
+    return lowered;
+}
+
+static std::string trim(const std::string &str) {
+    size_t start = str.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    return str.substr(start, str.find_last_not_of(" \t") - start + 1);
+}
+
+/**
+ * @brief カンマ区切りのトークン列に token が含まれるか（大文字・小文字は区別しない）。
+ */
+static bool hasToken(const std::string &list, const std::string &token) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        if (toLower(trim(list.substr(start, comma - start))) == token) {
+            return true;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
+
+Utf8Validator::Utf8Validator() : _need(0), _low(0x80), _high(0xBF) {}
+
+bool Utf8Validator::feed(unsigned char byte) {
+    if (_need > 0) {
+        if (byte < _low || byte > _high) {
+            return false;
+        }
+        --_need;
+        _low = 0x80;
+        _high = 0xBF;
+        return true;
+    }
+    if (byte < 0x80) {
+        return true;
+    }
+    // 先頭バイトから残りのバイト数と、2バイト目に許される範囲を決める
+    if (byte >= 0xC2 && byte <= 0xDF) {
+        _need = 1;
+    } else if (byte == 0xE0) {
+        _need = 2;
+        _low = 0xA0;   // 過長な表現を除く
+    } else if (byte == 0xED) {
+        _need = 2;
+        _high = 0x9F;  // サロゲートを除く
+    } else if (byte >= 0xE1 && byte <= 0xEF) {
+        _need = 2;
+    } else if (byte == 0xF0) {
+        _need = 3;
+        _low = 0x90;
+    } else if (byte >= 0xF1 && byte <= 0xF3) {
+        _need = 3;
+    } else if (byte == 0xF4) {
+        _need = 3;
+        _high = 0x8F;  // U+10FFFF まで
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool Utf8Validator::complete() const {
+    return _need == 0;
+}
+
+void Utf8Validator::reset() {
+    _need = 0;
+    _low = 0x80;
+    _high = 0xBF;
+}
+
+/**
+ * @brief data を UTF-8 として out に足す。不正なバイト列は U+FFFD に置き換える。
+ *        文字の途中で不正なバイトが来たら、そこまでを1つの U+FFFD にし、そのバイトから読み直す。
+ */
+static void appendAsUtf8(std::string &out, const char *data, size_t length) {
+    static const char REPLACEMENT[] = "\xEF\xBF\xBD";
+    Utf8Validator utf8;
+    size_t start = 0;  // 読んでいる文字の先頭
+    size_t i = 0;
+    while (i < length) {
+        if (utf8.feed(static_cast<unsigned char>(data[i]))) {
+            ++i;
+            if (utf8.complete()) {
+                out.append(data + start, i - start);
+                start = i;
+            }
+            continue;
+        }
+        out += REPLACEMENT;
+        if (i == start) {
+            ++i;  // 先頭として使えないバイトは捨てる
+        }
+        start = i;
+        utf8.reset();
+    }
+    if (start < length) {
+        out += REPLACEMENT;  // 文字の途中で行が終わった
+    }
+}
+
+static bool isUtf8(const char *data, size_t length) {
+    Utf8Validator utf8;
+    for (size_t i = 0; i < length; ++i) {
+        if (!utf8.feed(static_cast<unsigned char>(data[i]))) {
+            return false;
+        }
+    }
+    return utf8.complete();
+}
+
+WebSocketSession::WebSocketSession()
+    : _state(WS_HANDSHAKE), _binary(false), _messageOpen(false), _endsWithNewline(true),
+      _textMessage(false), _accountedInbound(0), _accountedOutbound(0) {}
+
+std::string &WebSocketSession::outbound() {
+    return _outbound;
+}
+
+bool WebSocketSession::hasOutbound() const {
+    return !_outbound.empty();
+}
+
+WebSocketSession::State WebSocketSession::state() const {
+    return _state;
+}
+
+size_t WebSocketSession::inboundCapacity() const {
+    return _inbound.capacity();
+}
+
+size_t WebSocketSession::outboundCapacity() const {
+    return _outbound.capacity();
+}
+
+size_t WebSocketSession::accountedInbound() const {
+    return _accountedInbound;
+}
+
+size_t WebSocketSession::accountedOutbound() const {
+    return _accountedOutbound;
+}
+
+void WebSocketSession::setAccounted(size_t inbound, size_t outbound) {
+    _accountedInbound = inbound;
+    _accountedOutbound = outbound;
+}
+
+// 大きなフレームを1つ受けたり送ったりしたあとの領域を、そのまま持ち続けない
+void WebSocketSession::shrink() {
+    if (_inbound.empty() && _inbound.capacity() > FRAME_BATCH) {
+        std::string().swap(_inbound);
+    }
+    if (_outbound.empty() && _outbound.capacity() > FRAME_BATCH) {
+        std::string().swap(_outbound);
+    }
+}
+
+void WebSocketSession::reject(const char *status, const char *extra_headers) {
+    _outbound += "HTTP/1.1 ";
+    _outbound += status;
+    _outbound += "\r\nConnection: close\r\nContent-Length: 0\r\n";
+    _outbound += extra_headers;
+    _outbound += "\r\n";
+    _state = WS_CLOSED;
+}
+
+/**
+ * @brief Upgrade 要求を読み、条件がそろっていれば 101 応答を積む。
+ *        要求がまだ揃っていなければ true のまま待ち、不正なら 4xx 応答を積んで false。
+ */
+bool WebSocketSession::readHandshake() {
+    size_t end = _inbound.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        if (_inbound.size() > MAX_HANDSHAKE) {
+            reject("431 Request Header Fields Too Large", "");
+            return false;
+        }
+        return true;
+    }
+    std::string request = _inbound.substr(0, end + 2);
+    _inbound.erase(0, end + 4);
+
+    std::string upgrade, connection, key, version, protocols;
+    size_t line_end = request.find("\r\n");
+    std::string request_line = request.substr(0, line_end);
+    for (size_t pos = line_end + 2; pos < request.size(); ) {
+        size_t next = request.find("\r\n", pos);
+        std::string line = request.substr(pos, next - pos);
+        pos = next + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = toLower(trim(line.substr(0, colon)));
+        std::string value = trim(line.substr(colon + 1));
+        if (name == "upgrade") upgrade = value;
+        else if (name == "connection") connection = value;
+        else if (name == "sec-websocket-key") key = value;
+        else if (name == "sec-websocket-version") version = value;
+        else if (name == "sec-websocket-protocol") protocols = value;
+    }
+
+    if (request_line.compare(0, 4, "GET ") != 0 || request_line.find(" HTTP/1.1") == std::string::npos ||
+        !hasToken(upgrade, "websocket") || !hasToken(connection, "upgrade") || key.empty()) {
+        reject("400 Bad Request", "");
+        return false;
+    }
+    if (version != "13") {
+        reject("426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+        return false;
+    }
+
+    _outbound += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n";
+    _outbound += "Sec-WebSocket-Accept: " + websocketAcceptKey(key) + "\r\n";
+    // IRCv3 のサブプロトコルが申し出られていれば選ぶ（binary を優先）
+    if (hasToken(protocols, "binary.ircv3.net")) {
+        _binary = true;
+        _outbound += "Sec-WebSocket-Protocol: binary.ircv3.net\r\n";
+    } else if (hasToken(protocols, "text.ircv3.net")) {
+        _outbound += "Sec-WebSocket-Protocol: text.ircv3.net\r\n";
+    }
+    _outbound += "\r\n";
+    _state = WS_OPEN;
+    return true;
+}
+
+/**
+ * @brief サーバーから送るフレームを積む（マスクはかけない）。
+ */
+void WebSocketSession::appendFrame(int opcode, const char *data, size_t length) {
+    _outbound += static_cast<char>(0x80 | opcode);
+    if (length < 126) {
+        _outbound += static_cast<char>(length);
+    } else if (length <= 0xffff) {
+        _outbound += static_cast<char>(126);
+        _outbound += static_cast<char>((length >> 8) & 0xff);
+        _outbound += static_cast<char>(length & 0xff);
+    } else {
+        _outbound += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            _outbound += static_cast<char>((static_cast<unsigned long long>(length) >> shift) & 0xff);
+        }
+    }
+    _outbound.append(data, length);
+}
+
+/**
+ * @brief 状態コードを付けた close フレームを送り、以降の受信は捨てる。
+ */
+void WebSocketSession::fail(unsigned short code) {
+    char body[2] = { static_cast<char>(code >> 8), static_cast<char>(code & 0xff) };
+    appendFrame(0x8, body, sizeof(body));
+    _state = WS_CLOSED;
+}
+
+/**
+ * @brief そろったフレームを順に解く。データフレームの本文は payload へ、
+ *        ping には pong を返し、close には close を返して false。
+ */
+bool WebSocketSession::readFrames(std::string &payload) {
+    while (_state == WS_OPEN) {
+        if (_inbound.size() < 2) {
+            return true;
+        }
+        const unsigned char *p = reinterpret_cast<const unsigned char*>(_inbound.data());
+        bool fin = (p[0] & 0x80) != 0;
+        int opcode = p[0] & 0x0f;
+        bool masked = (p[1] & 0x80) != 0;
+        unsigned long long length = p[1] & 0x7f;
+        size_t header = 2;
+        if ((p[0] & 0x70) != 0 || !masked) {
+            // 拡張は扱わない。クライアントからのフレームは必ずマスクされている
+            fail(1002);
+            return false;
+        }
+        if (length == 126) {
+            if (_inbound.size() < 4) {
+                return true;
+            }
+            length = (static_cast<unsigned long long>(p[2]) << 8) | p[3];
+            header = 4;
+        } else if (length == 127) {
+            if (_inbound.size() < 10) {
+                return true;
+            }
+            length = 0;
+            for (int i = 0; i < 8; ++i) {
+                length = (length << 8) | p[2 + i];
+            }
+            header = 10;
+        }
+        bool control = (opcode & 0x8) != 0;
+        if (length > MAX_FRAME_PAYLOAD || (control && (length > 125 || !fin))) {
+            fail(control ? 1002 : 1009);
+            return false;
+        }
+        if (_inbound.size() < header + 4 + length) {
+            return true;
+        }
+
+        // マスクを外す
+        const unsigned char *mask = p + header;
+        std::string body(_inbound, header + 4, length);
+        for (size_t i = 0; i < body.size(); ++i) {
+            body[i] ^= mask[i % 4];
+        }
+        _inbound.erase(0, header + 4 + length);
+
+        if (opcode == 0x0 || opcode == 0x1 || opcode == 0x2) {
+            if ((opcode == 0x0) != _messageOpen) {
+                // 継続フレームの順序がおかしい
+                fail(1002);
+                return false;
+            }
+            if (opcode != 0x0) {
+                _textMessage = (opcode == 0x1);
+                _utf8.reset();
+            }
+            if (_textMessage) {
+                // テキストメッセージは UTF-8 でなければならない（文字がフレームをまたいでもよい）
+                bool valid = true;
+                for (size_t i = 0; valid && i < body.size(); ++i) {
+                    valid = _utf8.feed(static_cast<unsigned char>(body[i]));
+                }
+                if (!valid || (fin && !_utf8.complete())) {
+                    fail(1007);
+                    return false;
+                }
+            }
+            payload += body;
+            if (!body.empty()) {
+                _endsWithNewline = (body[body.size() - 1] == '\n');
+            }
+            _messageOpen = !fin;
+            if (fin && !_endsWithNewline) {
+                // 1メッセージ = 1行。改行のないメッセージは行として区切る
+                payload += "\r\n";
+                _endsWithNewline = true;
+            }
+        } else if (opcode == 0x9) {
+            appendFrame(0xA, body.data(), body.size());
+        } else if (opcode == 0x8) {
+            appendFrame(0x8, body.data(), body.size() >= 2 ? 2 : 0);
+            _state = WS_CLOSED;
+            return false;
+        } else if (opcode != 0xA) {
+            fail(1002);
+            return false;
+        }
+    }
+    return _state != WS_CLOSED;
+}
+
+bool WebSocketSession::receive(const char *data, size_t length, std::string &payload) {
+    if (_state == WS_CLOSED) {
+        return false;
+    }
+    _inbound.append(data, length);
+    if (_state == WS_HANDSHAKE && !readHandshake()) {
+        return false;
+    }
+    if (_state == WS_HANDSHAKE) {
+        return true;
+    }
+    return readFrames(payload);
+}
+
+size_t WebSocketSession::frameLines(const char *data, size_t length) {
+    if (_state != WS_OPEN) {
+        return 0;
+    }
+    int opcode = _binary ? 0x2 : 0x1;
+    size_t consumed = 0;
+    while (consumed < length) {
+        const char *newline = static_cast<const char*>(std::memchr(data + consumed, '\n', length - consumed));
+        if (newline == NULL) {
+            break;
+        }
+        size_t line_length = newline - (data + consumed);
+        if (line_length > 0 && data[consumed + line_length - 1] == '\r') {
+            --line_length;
+        }
+        const char *line = data + consumed;
+        if (_binary || isUtf8(line, line_length)) {
+            appendFrame(opcode, line, line_length);
+        } else {
+            std::string replaced;
+            appendAsUtf8(replaced, line, line_length);
+            appendFrame(opcode, replaced.data(), replaced.size());
+        }
+        consumed = newline + 1 - data;
+        if (consumed >= FRAME_BATCH) {
+            break;
+        }
+    }
+    return consumed;
+}